@@ -3,7 +3,7 @@
 #include <string>
 #include <cstdint>
 #include <vector>
-#include <map>
+#include <array>
 #include <memory>
 #include <algorithm>
 #include <cmath>
@@ -29,41 +29,46 @@ void raw_write(std::ostream& output, T value) {
 class bit_writer {
 private:
 	std::ostream& output_;
-	uint8_t buffer_ = 0;
+	uint64_t buffer_ = 0;
 	uint8_t bits_in_buffer = 0;
+	std::vector<uint8_t> block_;
+
+	void flush_block() {
+		output_.write(reinterpret_cast<char*>(block_.data()), block_.size());
+		block_.clear();
+	}
 
 public:
-	bit_writer(std::ostream& output) : output_(output) {}
+	bit_writer(std::ostream& output) : output_(output) {
+		block_.reserve(1 << 16);
+	}
 
 	void write_bit(bool bit) {
+		write_number(bit, 1);
+	}
 
-		if (bit) {
-			buffer_ |= 1;
-		}
+	// Up to 32 bits at a time, the whole bytes are moved to the block
+	void write_number(uint64_t value, uint8_t number_of_bits) {
 
-		bits_in_buffer++;
+		buffer_ = (buffer_ << number_of_bits) | (value & ((uint64_t(1) << number_of_bits) - 1));
+		bits_in_buffer += number_of_bits;
 
-		if (bits_in_buffer == 8) {
-			raw_write(output_, buffer_);
-			buffer_ = 0;
-			bits_in_buffer = 0;
+		while (bits_in_buffer >= 8) {
+			bits_in_buffer -= 8;
+			block_.push_back(static_cast<uint8_t>(buffer_ >> bits_in_buffer));
 		}
-		else {
-			buffer_ <<= 1;
-		}
-	}
 
-	void write_number(uint64_t value, uint8_t number_of_bits) {
-		for (uint8_t i = 0; i < number_of_bits; ++i) {
-			bool bit = (value >> (number_of_bits - i - 1)) & 1;
-			write_bit(bit);
+		if (block_.size() >= (1 << 16)) {
+			flush_block();
 		}
 	}
 
 	~bit_writer() {
-		while (bits_in_buffer > 0) {
-			write_bit(0);
+		if (bits_in_buffer > 0) {
+			write_number(0, 8 - bits_in_buffer);
 		}
+
+		flush_block();
 	}
 };
 
@@ -146,7 +151,7 @@ public:
 		data_[row * columns_ + column] = value;
 	}
 
-	const std::vector<T> data() const {
+	const std::vector<T>& data() const {
 		return data_;
 	}
 
@@ -352,6 +357,13 @@ struct symbol_data {
 	uint8_t code_length = 0;
 };
 
+// The residuals are between -255 and 255 (written on 9 bits): offsetting them by 256
+// every symbol indexes a flat array, no lookup structure is needed
+constexpr int32_t symbol_offset = 256;
+constexpr size_t alphabet_size = 512;
+
+using symbols_table = std::array<symbol_data, alphabet_size>;
+
 struct huffman_node {
 	uint32_t frequency;
 	std::vector<int32_t> symbols;
@@ -381,18 +393,24 @@ struct huffman_node {
 
 class huffman {
 private:
-	void calculate_frequencies(const matrix<int32_t>& raw_data, std::map<uint32_t, symbol_data>& symbols_data) {
-		for (auto& symbol : raw_data.data()) {
-			symbol_data& symbol_data = symbols_data[symbol];
-			symbol_data.symbol = symbol;
-			symbol_data.frequency += 1;
+	void calculate_frequencies(const matrix<int32_t>& raw_data, symbols_table& symbols_data) {
+
+		std::array<uint32_t, alphabet_size> frequencies{};
+
+		for (const auto& symbol : raw_data.data()) {
+			frequencies[symbol + symbol_offset]++;
+		}
+
+		for (size_t i = 0; i < alphabet_size; ++i) {
+			symbols_data[i].symbol = static_cast<int32_t>(i) - symbol_offset;
+			symbols_data[i].frequency = frequencies[i];
 		}
 	}
 
-	void calculate_code_length(std::map<uint32_t, symbol_data>& symbols_data, std::shared_ptr<huffman_node> node, int depth) {
+	void calculate_code_length(symbols_table& symbols_data, std::shared_ptr<huffman_node> node, int depth) {
 		
 		if (node->low_frequency_node == nullptr && node->high_frequency_node == nullptr) {
-			symbol_data& symbol_data = symbols_data[node->symbols.front()];
+			symbol_data& symbol_data = symbols_data[node->symbols.front() + symbol_offset];
 			symbol_data.code_length = depth;
 			return;
 		}
@@ -401,12 +419,15 @@ private:
 		calculate_code_length(symbols_data, node->high_frequency_node, depth + 1);
 	}
 
-	std::vector<symbol_data> get_symbols_sorted_by_code_length(const std::map<uint32_t, symbol_data>& symbols_data) {
+	// Only the symbols in use: they appear in the data or they have a code
+	std::vector<symbol_data> get_symbols_sorted_by_code_length(const symbols_table& symbols_data) {
 
 		std::vector<symbol_data> sorted_symbols;
 
 		for (auto& symbol_data : symbols_data) {
-			sorted_symbols.push_back(symbol_data.second);
+			if (symbol_data.frequency > 0 || symbol_data.code_length > 0) {
+				sorted_symbols.push_back(symbol_data);
+			}
 		}
 
 		std::sort(sorted_symbols.begin(), sorted_symbols.end(),
@@ -422,7 +443,7 @@ private:
 		return sorted_symbols;
 	}
 
-	void generate_canonical_code_from_length(std::map<uint32_t, symbol_data>& symbols_data) {
+	void generate_canonical_code_from_length(symbols_table& symbols_data) {
 
 		auto sorted_symbols_data = get_symbols_sorted_by_code_length(symbols_data);
 
@@ -432,20 +453,28 @@ private:
 		for (auto& symbol_data : sorted_symbols_data) {
 			uint32_t shifts = symbol_data.code_length - previous_length;
 			current_value <<= shifts;
-			symbols_data[symbol_data.symbol].code = current_value;
+			symbols_data[symbol_data.symbol + symbol_offset].code = current_value;
 			current_value += 1;
 			previous_length = symbol_data.code_length;
 		}
 	}
 
-	void calculate_canonical_code(const matrix<int32_t>& raw_data, std::map<uint32_t, symbol_data>& symbols_data) {
+	void calculate_canonical_code(const matrix<int32_t>& raw_data, symbols_table& symbols_data) {
 
 		calculate_frequencies(raw_data, symbols_data);
 
 		std::vector<std::shared_ptr<huffman_node>> tree;
 
-		for (auto& symbol_data : symbols_data) {
-			auto node = std::make_shared<huffman_node>(huffman_node(symbol_data.second.frequency, { symbol_data.second.symbol }));
+		// Non negative symbols first, then the negative ones (the order of their unsigned values)
+		for (size_t i = 0; i < alphabet_size; ++i) {
+
+			const symbol_data& symbol_data = symbols_data[(i + symbol_offset) % alphabet_size];
+
+			if (symbol_data.frequency == 0) {
+				continue;
+			}
+
+			auto node = std::make_shared<huffman_node>(huffman_node(symbol_data.frequency, { symbol_data.symbol }));
 			tree.push_back(node);
 		}
 
@@ -494,10 +523,17 @@ public:
 	
 	bool encode_data(const std::string& file_name, const matrix<int32_t>& raw_data) {
 
-		std::map<uint32_t, symbol_data> symbols_data;
+		symbols_table symbols_data;
 
 		calculate_canonical_code(raw_data, symbols_data);
 
+		// Code and length packed together (code << 6 | length): a single load per pixel
+		std::array<uint64_t, alphabet_size> packed_codes{};
+
+		for (size_t i = 0; i < alphabet_size; ++i) {
+			packed_codes[i] = (static_cast<uint64_t>(symbols_data[i].code) << 6) | symbols_data[i].code_length;
+		}
+
 		std::ofstream output(file_name, std::ios::binary);
 
 		if (!output) {
@@ -511,19 +547,19 @@ public:
 		raw_write(output, raw_data.columns());
 		raw_write(output, raw_data.rows());
 
-		bit_writer.write_number(symbols_data.size(), 9);
-
 		auto sorted_symbols_data = get_symbols_sorted_by_code_length(symbols_data);
 
+		bit_writer.write_number(sorted_symbols_data.size(), 9);
+
 		for (auto& symbol_data : sorted_symbols_data) {
 
 			bit_writer.write_number(symbol_data.symbol, 9);
 			bit_writer.write_number(symbol_data.code_length, 5);
 		}
 
-		for (auto& symbol : raw_data.data()) {
-			auto& symbol_data = symbols_data[symbol];
-			bit_writer.write_number(symbol_data.code, symbol_data.code_length);
+		for (const auto& symbol : raw_data.data()) {
+			uint64_t packed_code = packed_codes[symbol + symbol_offset];
+			bit_writer.write_number(packed_code >> 6, packed_code & 0x3F);
 		}
 
 		return true;
@@ -572,7 +608,7 @@ public:
 	
 		raw_data.resize(height_read_result.first, width_read_result.first);
 
-		std::map<uint32_t, symbol_data> symbols_data;
+		symbols_table symbols_data;
 
 		for (uint32_t i = 0; i < number_of_elements_result.first; ++i) {
 
@@ -590,7 +626,7 @@ public:
 
 			int32_t symbol = fix_negative_number(symbol_result.first, 9);
 
-			symbol_data& symbol_data = symbols_data[symbol];
+			symbol_data& symbol_data = symbols_data[symbol + symbol_offset];
 			symbol_data.symbol = symbol;
 			symbol_data.code_length = static_cast<uint8_t>(code_length_result.first);
 		}
@@ -2,15 +2,17 @@
 #include <iostream>
 #include <cctype>
 #include <map>
-#include <list>
+#include <array>
 #include <algorithm>
 #include <vector>
 #include <memory>
 #include <cstdint>
 //#include <crtdbg.h>
 
+#include "../../support/read_data/read_data.h"
+
 struct huffman_node {
-	uint8_t frequency = 0;
+	uint32_t frequency = 0;
 	uint32_t code = 0;
 	uint8_t code_length = 0;
 	std::vector<uint8_t> symbols;
@@ -18,7 +20,7 @@ struct huffman_node {
 };
 
 struct symbol_data {
-	uint8_t frequency = 0;
+	uint32_t frequency = 0;
 	uint8_t length = 0;
 	uint32_t code = 0;
 };
@@ -27,42 +29,49 @@ class bit_writer {
 
 private:
 	std::ostream& output_;
-	uint8_t buffer_ = 0;
+	uint64_t buffer_ = 0;
 	uint8_t bits_in_buffer = 0;
+	std::vector<uint8_t> block_;
+
+	void flush_block() {
+		output_.write(reinterpret_cast<char*>(block_.data()), block_.size());
+		block_.clear();
+	}
 
 public:
-	bit_writer(std::ostream& output) : output_(output) { }
+	bit_writer(std::ostream& output) : output_(output) {
+		block_.reserve(1 << 16);
+	}
 
+	// Up to 32 bits at a time: they are added to a 64 bit word and the whole bytes are moved to the block
 	template<typename T>
 	void write_number(T number, uint8_t bits_to_write) {
-		for (uint8_t i = 0; i < bits_to_write; i++) {
-			bool bit_to_write = (number >> (bits_to_write - i - 1)) & 1;
-			write_bit(bit_to_write);
-		}
-	}
-
-	void write_bit(bool value) {
 
-		if (value) {
-			buffer_ |= 1;
-		}
+		uint64_t value = static_cast<uint64_t>(number) & ((uint64_t(1) << bits_to_write) - 1);
 
-		bits_in_buffer++;
+		buffer_ = (buffer_ << bits_to_write) | value;
+		bits_in_buffer += bits_to_write;
 
-		if (bits_in_buffer == 8) {
-			output_.write(reinterpret_cast<char*>(&buffer_), sizeof(buffer_));
-			buffer_ = 0;
-			bits_in_buffer = 0;
+		while (bits_in_buffer >= 8) {
+			bits_in_buffer -= 8;
+			block_.push_back(static_cast<uint8_t>(buffer_ >> bits_in_buffer));
 		}
-		else {
-			buffer_ <<= 1;
+
+		if (block_.size() >= (1 << 16)) {
+			flush_block();
 		}
 	}
 
+	void write_bit(bool value) {
+		write_number(value, 1);
+	}
+
 	void flush_buffer() {
-		while (bits_in_buffer > 0) {
-			write_bit(0);
+		if (bits_in_buffer > 0) {
+			write_number(0, 8 - bits_in_buffer);
 		}
+
+		flush_block();
 	}
 
 	~bit_writer() {
@@ -75,26 +84,21 @@ class huffman_encoder {
 private:
 	std::istream& input_;
 	bit_writer bit_writer_;
-	std::list<uint8_t> raw_data_;
+	std::vector<uint8_t> raw_data_;
 	std::map<uint8_t, symbol_data> symbols_data_;
 
-	void read_data() {
-		while (true) {
-			uint8_t buffer = 0;
-			input_.read(reinterpret_cast<char*>(&buffer), sizeof(buffer));
+	void calculate_frequency() {
 
-			if (input_.eof()) {
-				break;
-			}
+		std::array<uint32_t, 256> frequencies{};
 
-			raw_data_.push_back(buffer);
+		for (const auto& item : raw_data_) {
+			frequencies[item]++;
 		}
-	}
-
-	void calculate_frequency() {
 
-		for (const auto& item : raw_data_) {
-			symbols_data_[item].frequency += 1;
+		for (size_t symbol = 0; symbol < frequencies.size(); ++symbol) {
+			if (frequencies[symbol] > 0) {
+				symbols_data_[static_cast<uint8_t>(symbol)].frequency = frequencies[symbol];
+			}
 		}
 	}
 
@@ -146,9 +150,16 @@ private:
 			nodes_to_be_checked.push_back(merged);
 		}
 
+		std::shared_ptr<huffman_node> root = nodes_to_be_checked[0];
+
+		// A single symbol still needs one bit per occurrence
+		if (root->children.empty()) {
+			tree_navigation(root, 0, 1);
+			return;
+		}
+
 		// COMMENT: The first element of an array can be retrieved using the back function
 		// The symbol with the lowest probability (first item of the array) gets the 0, the other the 1
-		std::shared_ptr<huffman_node> root = nodes_to_be_checked[0];
 		tree_navigation(root->children[0], 0, 1);
 		tree_navigation(root->children[1], 1, 1);
 	}
@@ -193,14 +204,17 @@ private:
 			bit_writer_.write_number(item.second.code, item.second.length);
 		}
 
-		std::list<std::pair<uint32_t, uint8_t>> encoded_data;
-
 		// COMMENT: This can also be achieved by summing all frequencies in the frequency map, no need to pre store the raw data
 		bit_writer_.write_number(raw_data_.size(), 32);
 
-		// COMMENT: If the raw data is not prestored, we need to clear the state of the stream and seek to the beginning
+		std::array<symbol_data, 256> codes;
+
+		for (const auto& item : symbols_data_) {
+			codes[item.first] = item.second;
+		}
+
 		for (const auto& item : raw_data_) {
-			const symbol_data& symbol_data = symbols_data_[item];
+			const symbol_data& symbol_data = codes[item];
 			bit_writer_.write_number(symbol_data.code, symbol_data.length);
 		}
 	}
@@ -211,7 +225,7 @@ public:
 	void encode() {
 
 		// Reading data must be done upfront because the output format requires to know the number of encoded symbols in advance
-		read_data();
+		raw_data_ = read_data(input_);
 
 		// If there are no items then skip
 		if (raw_data_.size() == 0) {
@@ -279,10 +293,49 @@ class huffman_decoder {
 private:
 	bit_reader bit_reader_;
 	std::ostream& output_;	
-	std::list<uint8_t> raw_data_;
-	std::map<uint8_t, symbol_data> symbols_data_;
 
-	void read_header() {
+	// Decoding tree stored in a flat array: for each node the index of the two children,
+	// the leaves are stored as -(symbol + 1). The root is the node 0.
+	std::vector<std::array<int32_t, 2>> decoding_tree_ = { { 0, 0 } };
+
+	bool add_code(uint8_t symbol, uint32_t code, uint8_t length) {
+
+		if (length == 0) {
+			return false;
+		}
+
+		int32_t node = 0;
+
+		for (uint8_t i = length; i > 1; --i) {
+
+			uint32_t bit = (code >> (i - 1)) & 1;
+			int32_t child = decoding_tree_[node][bit];
+
+			if (child < 0) {
+				return false;
+			}
+
+			if (child == 0) {
+				child = static_cast<int32_t>(decoding_tree_.size());
+				decoding_tree_[node][bit] = child;
+				decoding_tree_.push_back({ 0, 0 });
+			}
+
+			node = child;
+		}
+
+		int32_t& leaf = decoding_tree_[node][code & 1];
+
+		if (leaf != 0) {
+			return false;
+		}
+
+		leaf = -(static_cast<int32_t>(symbol) + 1);
+
+		return true;
+	}
+
+	bool read_header() {
 
 		std::string magic_number;
 
@@ -290,7 +343,7 @@ private:
 			std::pair<char, bool> magin_number_character = bit_reader_.read_number<char>(8);
 
 			if (!magin_number_character.second) {
-				return;
+				return false;
 			}
 
 			magic_number.push_back(magin_number_character.first);
@@ -299,7 +352,7 @@ private:
 		std::pair<uint8_t, bool> table_entries_raw = bit_reader_.read_number<uint8_t>(8);
 
 		if (!table_entries_raw.second) {
-			return;
+			return false;
 		}
 
 		uint32_t table_entries = table_entries_raw.first > 0 ? table_entries_raw.first : 256;
@@ -309,25 +362,27 @@ private:
 			std::pair<uint8_t, bool> symbol_raw = bit_reader_.read_number<uint8_t>(8);
 
 			if (!symbol_raw.second) {
-				return;
+				return false;
 			}
 
 			std::pair<uint8_t, bool> symbol_length_raw = bit_reader_.read_number<uint8_t>(5);
 
 			if (!symbol_length_raw.second) {
-				return;
+				return false;
 			}
 
 			std::pair<uint32_t, bool> code_raw = bit_reader_.read_number<uint32_t>(symbol_length_raw.first);
 
 			if (!code_raw.second) {
-				return;
+				return false;
 			}
 
-			symbol_data& data = symbols_data_[symbol_raw.first];
-			data.code = code_raw.first;
-			data.length = symbol_length_raw.first;
+			if (!add_code(symbol_raw.first, code_raw.first, symbol_length_raw.first)) {
+				return false;
+			}
 		}
+
+		return true;
 	}
 
 	void read_write_data() {
@@ -338,41 +393,42 @@ private:
 			return;
 		}
 		
-		uint32_t symbols_to_read = numb_symbols_raw.first;
+		// The number of symbols is known, the output is decoded in a single buffer and written at once
+		std::vector<uint8_t> decoded_data(numb_symbols_raw.first);
 
-		uint32_t read_code = 0;
+		int32_t node = 0;
 
-		while (symbols_to_read > 0) {
-			std::pair<bool, bool> bit = bit_reader_.read_bit();
+		for (auto& item : decoded_data) {
 
-			if (!bit.second) {
-				return;
-			}
+			do {
+				std::pair<bool, bool> bit = bit_reader_.read_bit();
 
-			read_code <<= 1;
-
-			if (bit.first) {
-				read_code |= 1;
-			}
+				if (!bit.second) {
+					return;
+				}
 
-			for (const auto& data : symbols_data_) {
+				node = decoding_tree_[node][bit.first];
 
-				if (read_code == data.second.code) {
-					read_code = 0;
-					output_ << data.first;
-					symbols_to_read--;
-					break;
+				// Code not in the table
+				if (node == 0) {
+					return;
 				}
-			}
+			} while (node > 0);
+
+			item = static_cast<uint8_t>(-node - 1);
+			node = 0;
 		}
+
+		output_.write(reinterpret_cast<char*>(decoded_data.data()), decoded_data.size());
 	}
 
 public:
 	huffman_decoder(std::istream& input, std::ostream& output) : bit_reader_(input), output_(output) { }
 
 	void decode() {
-		read_header();
-		read_write_data();
+		if (read_header()) {
+			read_write_data();
+		}
 	}
 };
 
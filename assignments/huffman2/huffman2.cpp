@@ -7,8 +7,13 @@
 #include <numeric>
 #include <cstdint>
 #include <memory>
+#include <array>
+#include <cstring>
 //#include <crtdbg.h>
 
+#include "../../support/huffman/decoding.h"
+#include "../../support/huffman/table_cache.h"
+
 class bit_writer {
 private:
 	std::ostream& output_;
@@ -104,6 +109,12 @@ public:
 
 		return std::pair<uint64_t, bool>(value, true);
 	}
+
+	// Bits already taken from the stream but not consumed yet, aligned to the right
+	std::pair<uint8_t, uint8_t> pending_bits() const {
+		uint8_t mask = static_cast<uint8_t>((1u << bits_in_buffer_) - 1);
+		return std::pair<uint8_t, uint8_t>(buffer_ & mask, bits_in_buffer_);
+	}
 };
 
 struct symbol_data {
@@ -184,6 +195,9 @@ protected:
 	}
 };
 
+// Code length of every byte symbol, 0 for the symbols missing from the table
+using code_lengths = std::array<uint8_t, 256>;
+
 class canonical_huffman_encoder : public base_huffman {
 private:
 	std::istream& input_;
@@ -324,12 +338,25 @@ public:
 	}
 };
 
-class canonical_huffman_decoder : public base_huffman {
+class canonical_huffman_decoder {
 private:
+	using decode_table = decoding::huffman_decode_table<uint8_t>;
+
+	// Process-wide, shared by every decoder: the same code lengths recur across files
+	static decoding::table_cache<code_lengths, decode_table>& table_cache() {
+		static decoding::table_cache<code_lengths, decode_table> cache(64);
+		return cache;
+	}
+
+	std::istream& input_;
 	bit_reader bit_reader_;
 	std::ostream& output_;
 
-	void read_table() {
+	code_lengths code_lengths_{};
+	uint32_t table_entries_ = 0;
+	uint8_t last_symbol_ = 0;
+
+	bool read_table() {
 
 		std::string magic_number;
 
@@ -338,7 +365,7 @@ private:
 			auto result = bit_reader_.read_number(8);
 
 			if (!result.second) {
-				return;
+				return false;
 			}
 
 			magic_number.push_back(static_cast<char>(result.first));
@@ -347,34 +374,31 @@ private:
 		auto table_entries_raw = bit_reader_.read_number(8);
 
 		if (!table_entries_raw.second) {
-			return;
+			return false;
 		}
 
-		uint8_t table_entries = static_cast<uint8_t>(table_entries_raw.first);
+		// The encoder writes 0 when all the 256 symbols are used
+		table_entries_ = table_entries_raw.first == 0 ? 256 : static_cast<uint32_t>(table_entries_raw.first);
 
-		for (uint8_t i = 0; i < table_entries; ++i) {
+		for (uint32_t i = 0; i < table_entries_; ++i) {
 
 			auto symbol_raw = bit_reader_.read_number(8);
 
 			if (!symbol_raw.second) {
-				return;
+				return false;
 			}
 
-			uint8_t symbol = static_cast<uint8_t>(symbol_raw.first);
-
-			symbol_data& data = symbols_data_[symbol];
-			data.symbol = symbol;
-
 			auto code_length_raw = bit_reader_.read_number(5);
 
 			if (!code_length_raw.second) {
-				return;
+				return false;
 			}
 
-			data.code_length = static_cast<uint8_t>(code_length_raw.first);	
+			last_symbol_ = static_cast<uint8_t>(symbol_raw.first);
+			code_lengths_[last_symbol_] = static_cast<uint8_t>(code_length_raw.first);
 		}
 
-		calculate_canonical_huffman();
+		return true;
 	}
 
 	void read_data() {
@@ -388,68 +412,86 @@ private:
 		uint32_t number_of_symbols = static_cast<uint32_t>(number_of_symbols_raw.first);
 
 		uint32_t read_symbols = number_of_symbols;
-		uint32_t code = 0;
 
-		uint32_t read_bits = 0;
+		decoding::block_writer writer(output_);
+
+		// A single symbol gets a zero length code, nothing else has been written
+		if (table_entries_ == 1 && code_lengths_[last_symbol_] == 0) {
+			for (; read_symbols > 0; --read_symbols) {
+				writer.write(last_symbol_);
+			}
 
-		// Optimization
-		auto sorted_symbols = create_sorted_symbols_data();
+			return;
+		}
 
-		uint32_t min_code_length = sorted_symbols.front().get().code_length;
+		// nullptr if the lengths don't describe a valid prefix code
+		auto table = table_cache().get(code_lengths_, [](const code_lengths& lengths) {
+			auto new_table = std::make_shared<decode_table>();
+			return new_table->build_from_lengths(lengths) ? new_table : nullptr;
+		});
 
-		while (read_symbols > 0) {
-			auto bit_raw = bit_reader_.read_bit();
+		if (table == nullptr) {
+			return;
+		}
 
-			// This exists in case the file reached eof
-			if (!bit_raw.second) {
-				return;
-			}
+		decoding::word_bit_reader reader(input_, bit_reader_.pending_bits());
 
-			bool bit = bit_raw.first;
+		while (read_symbols > 0) {
 
-			code <<= 1;
+			reader.refill();
 
-			if (bit) {
-				code |= 1;
-			}
+			// Close to the end of the stream the last codes may be shorter than the longest one
+			if (reader.available() < table->max_length()) {
+				auto decoded = table->decode(reader);
 
-			read_bits++;
+				// This exists in case the file reached eof
+				if (decoded.second == 0 || decoded.second > reader.available()) {
+					return;
+				}
 
-			// Optimization
-			if ( read_bits < min_code_length) {
+				reader.consume(decoded.second);
+				writer.write(decoded.first);
+				read_symbols--;
 				continue;
 			}
 
-			for (const auto& container_item : sorted_symbols) {
-
-				auto& symbol_reference = container_item.get();
+			// Decode as many codes as the buffer surely holds before refilling
+			while (read_symbols > 0 && reader.available() >= table->max_length()) {
+				auto decoded = table->decode(reader);
 
-				bool match = read_bits == symbol_reference.code_length && symbol_reference.code == code;
+				if (decoded.second == 0) {
+					return;
+				}
 
-				if (match) {
-					output_ << symbol_reference.symbol;
-					read_symbols--;
-					code = 0;
-					read_bits = 0;
-					break;
-				}	
+				reader.consume(decoded.second);
+				writer.write(decoded.first);
+				read_symbols--;
 			}
 		}
 	}
 
 public:
-	canonical_huffman_decoder(std::istream& input, std::ostream& output) : bit_reader_(input), output_(output) { }
+	canonical_huffman_decoder(std::istream& input, std::ostream& output) : input_(input), bit_reader_(input), output_(output) { }
 
 	void decode() {
-		read_table();
-		read_data();
+		if (read_table()) {
+			read_data();
+		}
+	}
+
+	// Hits, misses and evictions of the decoding tables shared by all the decoders
+	static decoding::cache_statistics table_cache_statistics() {
+		return table_cache().stats();
 	}
 };
 
 int main(int argc, char* argv[]) {
 
 	{
-		if (argc != 4) {
+		// An optional --cache-stats writes the counters of the decoding tables cache to stderr
+		bool cache_stats = argc == 5 && std::string(argv[4]) == "--cache-stats";
+
+		if (argc != 4 && !cache_stats) {
 			std::cout << "Invalid number of arguments" << std::endl;
 			return EXIT_FAILURE;
 		}
@@ -491,6 +533,10 @@ int main(int argc, char* argv[]) {
 		else {
 			canonical_huffman_decoder decoder(input, output);
 			decoder.decode();
+
+			if (cache_stats) {
+				std::cerr << "Decoding tables cache: " << canonical_huffman_decoder::table_cache_statistics() << std::endl;
+			}
 		}
 	}
 
@@ -2,210 +2,487 @@
 #include <fstream>
 #include <cstdint>
 #include <vector>
-#include <iterator>
+#include <utility>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <atomic>
 //#include <crtdbg.h>
 
-static std::pair<uint8_t, bool> raw_read(std::istream& input) {
-	uint8_t buffer = 0;
-	input.read(reinterpret_cast<char*>(&buffer), sizeof(buffer));
-	return std::pair<uint8_t, bool>(buffer, !input.eof());
-}
-
-static void raw_write(const uint8_t& value, std::ostream& output) {
-	output.write(reinterpret_cast<const char*>(&value), sizeof(value));
-}
+#include "../../support/packbits/packbits.h"
+#include "../../support/read_data/read_data.h"
+#include "../../support/thread_pool/thread_pool.h"
 
 class packbits_encoder {
 private:
 	std::istream& input_;
 	std::ostream& output_;
-	std::vector<uint8_t> buffer_;
 
-	bool run_mode = true;
+public:
+	packbits_encoder(std::istream& input, std::ostream& output) : input_(input), output_(output) {}
+
+	// The commands plus the EOD
+	static size_t max_encoded_size(size_t size) {
+		return packbits::max_encoded_size(size) + 1;
+	}
+
+	// Encodes size bytes into output, which must hold max_encoded_size(size) bytes. Returns the encoded size.
+	static size_t encode(const uint8_t* data, size_t size, uint8_t* output) {
+
+		size_t encoded_size = packbits::encode(data, size, output);
+
+		// EOD
+		output[encoded_size++] = 128;
+
+		return encoded_size;
+	}
+
+	void encode() {
+
+		std::vector<uint8_t> data = read_data(input_);
+		std::vector<uint8_t> encoded(max_encoded_size(data.size()));
+
+		size_t encoded_size = encode(data.data(), data.size(), encoded.data());
+
+		output_.write(reinterpret_cast<const char*>(encoded.data()), encoded_size);
+	}
+};
 
-	void write_buffer_as_run() {
+class packbits_decoder {
+private:
+	std::istream& input_;
+	std::ostream& output_;
 
-		if (buffer_.size() == 0) {
-			return;
+public:
+	packbits_decoder(std::istream& input, std::ostream& output) : input_(input), output_(output) {}
+
+	// Validates the commands and returns the exact decoded size, false if the data is truncated
+	static std::pair<size_t, bool> decoded_size(const uint8_t* data, size_t size) {
+
+		size_t decoded = 0;
+		size_t i = 0;
+
+		while (i < size) {
+
+			uint8_t command = data[i++];
+
+			if (command < 128) {
+				size_t bytes = command + 1;
+
+				if (size - i < bytes) {
+					return std::pair<size_t, bool>(decoded, false);
+				}
+
+				decoded += bytes;
+				i += bytes;
+			}
+			else if (command == 128) {
+				break; // EOD
+			}
+			else {
+				if (i == size) {
+					return std::pair<size_t, bool>(decoded, false);
+				}
+
+				decoded += 257 - command;
+				i++;
+			}
 		}
 
-		// Only take up to 128 bytes from the buffer
-		uint8_t bytes_in_buffer = std::min<uint8_t>(static_cast<uint8_t>(buffer_.size()), 128);
+		return std::pair<size_t, bool>(decoded, true);
+	}
+
+	// Decodes the data into output, which holds capacity bytes. Returns the decoded size,
+	// false if the data is truncated or does not fit in output.
+	static std::pair<size_t, bool> decode(const uint8_t* data, size_t size, uint8_t* output, size_t capacity) {
 
-		uint8_t run_length_byte = 257 - bytes_in_buffer;
-		raw_write(run_length_byte, output_);
+		size_t written = 0;
+		size_t i = 0;
 
-		uint8_t value = buffer_.back();
-		raw_write(value, output_);
+		while (i < size) {
 
-		//std::cout << "RUN (" << buffer_.size() << ", " << value << ")" << std::endl;
+			uint8_t command = data[i++];
 
-		buffer_.clear();
+			if (command == 128) {
+				break; // EOD
+			}
+
+			size_t bytes = command < 128 ? command + 1 : 257 - command;
+			size_t needed = command < 128 ? bytes : 1;
+
+			if (size - i < needed || capacity - written < bytes) {
+				return std::pair<size_t, bool>(written, false);
+			}
+
+			if (command < 128) {
+				std::memcpy(output + written, data + i, bytes);
+			}
+			else {
+				std::memset(output + written, data[i], bytes);
+			}
+
+			written += bytes;
+			i += needed;
+		}
+
+		return std::pair<size_t, bool>(written, true);
 	}
 
-	void write_buffer_as_copy() {
+	// Decodes the data into output with a single allocation when preflight is set, growing it as needed otherwise.
+	// Returns false, leaving output with what was decoded so far, if the data is truncated.
+	static bool decode(const uint8_t* data, size_t size, std::vector<uint8_t>& output, bool preflight = true) {
+
+		if (preflight) {
+			auto decoded = decoded_size(data, size);
+
+			if (!decoded.second) {
+				output.clear();
+				return false;
+			}
+
+			output.resize(decoded.first);
+
+			return decode(data, size, output.data(), output.size()).second;
+		}
+
+		size_t written = 0;
+		size_t i = 0;
+		bool valid = true;
+
+		while (i < size) {
+
+			uint8_t command = data[i++];
+
+			if (command == 128) {
+				break; // EOD
+			}
+
+			size_t bytes = command < 128 ? command + 1 : 257 - command;
+			size_t needed = command < 128 ? bytes : 1;
+
+			if (size - i < needed) {
+				valid = false;
+				break;
+			}
+
+			if (output.size() - written < bytes) {
+				output.resize(std::max(output.size() * 2, written + bytes));
+			}
+
+			if (command < 128) {
+				std::memcpy(output.data() + written, data + i, bytes);
+			}
+			else {
+				std::memset(output.data() + written, data[i], bytes);
+			}
 
-		if (buffer_.size() == 0) {
-			return;
+			written += bytes;
+			i += needed;
 		}
 
-		// Only take up to 128 bytes from the buffer
-		uint8_t bytes_in_buffer = std::min<uint8_t>(static_cast<uint8_t>(buffer_.size()), 128);
+		output.resize(written);
 
-		// COPY is 0 based
-		uint8_t elements_to_copy = bytes_in_buffer - 1; 
+		return valid;
+	}
+
+	bool decode() {
 
-		raw_write(elements_to_copy, output_);
+		std::vector<uint8_t> data = read_data(input_);
+		std::vector<uint8_t> decoded;
 
-		for (const auto& container_item : buffer_) {
-			raw_write(container_item, output_);
+		if (!decode(data.data(), data.size(), decoded)) {
+			return false;
 		}
 
-		//std::cout << "COPY (" << buffer_.size() << ", " << std::string(buffer_.begin(), buffer_.end()) << ")" << std::endl;
+		output_.write(reinterpret_cast<const char*>(decoded.data()), decoded.size());
 
-		buffer_.clear();
+		return true;
 	}
+};
 
-	void write_eod() {
-		raw_write(128, output_);
-		//std::cout << "EOD" << std::endl;
+static void write_le(std::vector<uint8_t>& output, uint64_t value, size_t bytes) {
+	for (size_t i = 0; i < bytes; ++i) {
+		output.push_back(static_cast<uint8_t>(value >> (8 * i)));
 	}
+}
 
-	void write_buffer() {
-		if (run_mode) {
-			write_buffer_as_run();
-		}
-		else {
-			write_buffer_as_copy();
-		}
+static uint64_t read_le(const uint8_t* input, size_t bytes) {
+	uint64_t value = 0;
+
+	for (size_t i = 0; i < bytes; ++i) {
+		value |= static_cast<uint64_t>(input[i]) << (8 * i);
 	}
 
+	return value;
+}
+
+// Chunked container: the input is split in chunks of chunk_size bytes, each one an independent PackBits stream.
+// All the values are little endian:
+//   "PBCK" | chunk size (4) | decoded size (8) | chunks count (4)
+//   for each chunk: offset from the first chunk (8) | encoded size (4) | decoded size (4)
+//   the encoded chunks
+namespace packbits_container {
+	static const char magic[4] = { 'P', 'B', 'C', 'K' };
+	static const size_t header_size = 20;
+	static const size_t index_entry_size = 16;
+	static const uint32_t default_chunk_size = 1 << 20;
+
+	// A run of 128 bytes takes 2, nothing expands more
+	static const uint64_t max_expansion = 64;
+
+	struct chunk_entry {
+		uint64_t offset;
+		uint32_t encoded_size;
+		uint32_t decoded_size;
+	};
+}
+
+class packbits_container_encoder {
+private:
+	std::istream& input_;
+	std::ostream& output_;
+	uint32_t chunk_size_;
+	thread_pool pool_;
+
 public:
-	packbits_encoder(std::istream& input, std::ostream& output) : input_(input), output_(output) {}
+	packbits_container_encoder(std::istream& input, std::ostream& output, uint32_t chunk_size = packbits_container::default_chunk_size)
+		: input_(input), output_(output), chunk_size_(std::max<uint32_t>(chunk_size, 1)) {}
 
 	void encode() {
-		for (std::istream_iterator<uint8_t> it(input_); it != std::istream_iterator<uint8_t>(); ++it) {
-
-			uint8_t value = *it;
-
-			if (!buffer_.empty()) {
-
-				uint8_t last_buffer_value = buffer_.back();
-
-				if (run_mode) {
-					if (last_buffer_value != value) {
-						if (buffer_.size() > 1) {
-							// write runs only if there are at least 2 elements in the buffer
-							write_buffer_as_run();
-						}
-						else {
-							run_mode = false;
-						}
-					}
-					else if (buffer_.size() >= 128) {
-						// Write the buffer if the run exceeds 128 repetitions
-						write_buffer();
-					}
-				}
-				else if (!run_mode) {
-					if (last_buffer_value == value) {
-						// Remove the last element from the array because it belongs to the run
-						buffer_.pop_back();
-						write_buffer_as_copy();
-						buffer_.push_back(last_buffer_value);
-						run_mode = true;
-					}
-					else if (buffer_.size() >= 128) {
-						// Write the buffer if the copy exceeds 128 elements
-						write_buffer();
-					}	
-				}
-			}
 
-			// In theory for runs we don't need to store all the values, but just the symbol and the count of symbols found
-			buffer_.push_back(value);
+		std::vector<uint8_t> data = read_data(input_);
+
+		size_t chunks_count = (data.size() + chunk_size_ - 1) / chunk_size_;
+		std::vector<std::vector<uint8_t>> chunks(chunks_count);
+
+		pool_.run(chunks_count, [&](size_t index) {
+			size_t begin = index * chunk_size_;
+			size_t size = std::min<size_t>(chunk_size_, data.size() - begin);
+
+			chunks[index].resize(packbits_encoder::max_encoded_size(size));
+			chunks[index].resize(packbits_encoder::encode(data.data() + begin, size, chunks[index].data()));
+		});
+
+		std::vector<uint8_t> header;
+		header.reserve(packbits_container::header_size + chunks_count * packbits_container::index_entry_size);
+
+		header.insert(header.end(), packbits_container::magic, packbits_container::magic + 4);
+		write_le(header, chunk_size_, 4);
+		write_le(header, data.size(), 8);
+		write_le(header, chunks_count, 4);
+
+		uint64_t offset = 0;
+
+		for (size_t index = 0; index < chunks_count; ++index) {
+			write_le(header, offset, 8);
+			write_le(header, chunks[index].size(), 4);
+			write_le(header, std::min<size_t>(chunk_size_, data.size() - index * chunk_size_), 4);
+
+			offset += chunks[index].size();
 		}
 
-		write_buffer();
-		write_eod();
+		output_.write(reinterpret_cast<const char*>(header.data()), header.size());
+
+		for (const auto& chunk : chunks) {
+			output_.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+		}
 	}
 };
 
-class packbits_decoder {
+class packbits_container_decoder {
 private:
 	std::istream& input_;
-	std::ostream& output_;
+	uint32_t chunk_size_ = 0;
+	uint64_t decoded_size_ = 0;
+	std::streamoff data_begin_ = 0;
+	std::vector<packbits_container::chunk_entry> chunks_;
+	thread_pool pool_;
+
+public:
+	packbits_container_decoder(std::istream& input) : input_(input) {}
+
+	uint64_t decoded_size() const {
+		return decoded_size_;
+	}
 
-	void handle_run(uint8_t value) {
-		uint8_t repetitions = 257 - value;
+	// Reads and validates the header and the chunks index. The sizes in the header are checked against the size of
+	// the file before anything is allocated from them.
+	bool read_index() {
 
-		auto symbol = raw_read(input_);
+		uint8_t header[packbits_container::header_size];
 
-		if (!symbol.second) {
-			return;
+		if (!input_.read(reinterpret_cast<char*>(header), sizeof(header))) {
+			return false;
 		}
 
-		for (int i = 0; i < repetitions; ++i) {
-			raw_write(symbol.first, output_);
+		if (!std::equal(packbits_container::magic, packbits_container::magic + 4, header)) {
+			return false;
 		}
-	}
 
-	void handle_copy(uint8_t value) {
-		uint8_t charaters_to_read = value + 1;
+		chunk_size_ = static_cast<uint32_t>(read_le(header + 4, 4));
+		decoded_size_ = read_le(header + 8, 8);
+		uint64_t chunks_count = read_le(header + 16, 4);
+
+		if (chunk_size_ == 0 || chunks_count != decoded_size_ / chunk_size_ + (decoded_size_ % chunk_size_ != 0)) {
+			return false;
+		}
+
+		std::streamoff index_begin = input_.tellg();
+		input_.seekg(0, std::ios::end);
+		std::streamoff file_end = input_.tellg();
+		input_.seekg(index_begin);
 
-		for (int i = 0; i < charaters_to_read; ++i) {
+		if (index_begin < 0 || file_end < index_begin) {
+			return false;
+		}
 
-			auto symbol = raw_read(input_);
+		uint64_t remaining = static_cast<uint64_t>(file_end - index_begin);
 
-			if (!symbol.second) {
-				return;
+		if (chunks_count * packbits_container::index_entry_size > remaining) {
+			return false;
+		}
+
+		remaining -= chunks_count * packbits_container::index_entry_size;
+
+		std::vector<uint8_t> index(static_cast<size_t>(chunks_count) * packbits_container::index_entry_size);
+
+		if (!input_.read(reinterpret_cast<char*>(index.data()), index.size())) {
+			return false;
+		}
+
+		chunks_.resize(static_cast<size_t>(chunks_count));
+
+		uint64_t offset = 0;
+
+		for (size_t i = 0; i < chunks_.size(); ++i) {
+			const uint8_t* entry = index.data() + i * packbits_container::index_entry_size;
+
+			chunks_[i].offset = read_le(entry, 8);
+			chunks_[i].encoded_size = static_cast<uint32_t>(read_le(entry + 8, 4));
+			chunks_[i].decoded_size = static_cast<uint32_t>(read_le(entry + 12, 4));
+
+			uint64_t expected_size = std::min<uint64_t>(chunk_size_, decoded_size_ - i * uint64_t(chunk_size_));
+
+			if (chunks_[i].offset != offset || chunks_[i].decoded_size != expected_size ||
+				chunks_[i].decoded_size > chunks_[i].encoded_size * packbits_container::max_expansion) {
+				return false;
 			}
 
-			raw_write(symbol.first, output_);
+			offset += chunks_[i].encoded_size;
 		}
+
+		// The encoded chunks must all be in the file
+		if (offset > remaining) {
+			return false;
+		}
+
+		data_begin_ = input_.tellg();
+
+		return true;
 	}
 
-public:
-	packbits_decoder(std::istream& input, std::ostream& output) : input_(input), output_(output) {}
+	// Decodes length bytes starting from offset, only reading and decoding the chunks that overlap the range.
+	// The range is clamped to the end of the data, false if the offset is past it or the chunks are malformed.
+	std::pair<std::vector<uint8_t>, bool> read_range(uint64_t offset, uint64_t length) {
 
-	void decode() {
+		std::vector<uint8_t> result;
 
-		while (true) {
+		if (offset > decoded_size_) {
+			return std::make_pair(result, false);
+		}
 
-			auto next_command = raw_read(input_);
+		length = std::min(length, decoded_size_ - offset);
 
-			if (!next_command.second) {
-				break;
-			}
+		if (length == 0) {
+			return std::make_pair(result, true);
+		}
 
-			if (next_command.first < 128) {
-				handle_copy(next_command.first);
-			}
-			else if (next_command.first == 128) { 
-				break; // EOD
+		size_t first = static_cast<size_t>(offset / chunk_size_);
+		size_t last = static_cast<size_t>((offset + length - 1) / chunk_size_);
+
+		// The chunks are contiguous, a single read takes all of them
+		uint64_t encoded_begin = chunks_[first].offset;
+		uint64_t encoded_end = chunks_[last].offset + chunks_[last].encoded_size;
+
+		std::vector<uint8_t> encoded(static_cast<size_t>(encoded_end - encoded_begin));
+
+		input_.clear();
+		input_.seekg(data_begin_ + static_cast<std::streamoff>(encoded_begin));
+
+		if (!input_.read(reinterpret_cast<char*>(encoded.data()), encoded.size())) {
+			return std::make_pair(result, false);
+		}
+
+		uint64_t decoded_begin = first * uint64_t(chunk_size_);
+		std::vector<uint8_t> decoded(static_cast<size_t>((last - first) * uint64_t(chunk_size_) + chunks_[last].decoded_size));
+		std::atomic<bool> valid(true);
+
+		pool_.run(last - first + 1, [&](size_t index) {
+			const auto& chunk = chunks_[first + index];
+
+			auto chunk_result = packbits_decoder::decode(encoded.data() + (chunk.offset - encoded_begin), chunk.encoded_size,
+				decoded.data() + index * size_t(chunk_size_), chunk.decoded_size);
+
+			if (!chunk_result.second || chunk_result.first != chunk.decoded_size) {
+				valid = false;
 			}
-			else {
-				handle_run(next_command.first);
+		});
+
+		if (!valid) {
+			return std::make_pair(result, false);
+		}
+
+		size_t skip = static_cast<size_t>(offset - decoded_begin);
+
+		if (skip == 0 && decoded.size() == length) {
+			return std::make_pair(std::move(decoded), true);
+		}
+
+		result.assign(decoded.begin() + skip, decoded.begin() + skip + static_cast<size_t>(length));
+
+		return std::make_pair(std::move(result), true);
+	}
+
+	// Decodes everything, a group of chunks at a time to limit the memory used
+	bool decode(std::ostream& output) {
+
+		uint64_t group_size = uint64_t(chunk_size_) * std::max(std::thread::hardware_concurrency(), 1u) * 4;
+
+		for (uint64_t offset = 0; offset < decoded_size_; offset += group_size) {
+			auto range = read_range(offset, group_size);
+
+			if (!range.second) {
+				return false;
 			}
+
+			output.write(reinterpret_cast<const char*>(range.first.data()), range.first.size());
 		}
+
+		return true;
 	}
 };
 
 int main(int argc, char* argv[]) {
 	{
-		if (argc != 4) {
+		if (argc < 4) {
 			std::cout << "Wrong arguments number" << std::endl;
+			std::cout << "Usage: packbits <c|d|C|D> <input> <output>" << std::endl;
+			std::cout << "       packbits R <input> <output> <offset> <length>" << std::endl;
 			return EXIT_FAILURE;
 		}
 
 		std::string mode(argv[1]);
 
-		if (!(mode == "c" || mode == "d")) {
-			std::cout << "The mode must be only one characted, either c or d" << std::endl;
+		if (!(mode == "c" || mode == "d" || mode == "C" || mode == "D" || mode == "R")) {
+			std::cout << "The mode must be only one characted: c or d for a single stream, C or D for the chunked container, R to read a range from it" << std::endl;
 			return EXIT_FAILURE;
 		}
 
-		bool compress = mode == "c";
+		if (argc != (mode == "R" ? 6 : 4)) {
+			std::cout << "Wrong arguments number" << std::endl;
+			return EXIT_FAILURE;
+		}
 
 		std::ifstream input(argv[2], std::ios::binary);
 
@@ -224,17 +501,50 @@ int main(int argc, char* argv[]) {
 			return EXIT_FAILURE;
 		}
 
-		if (compress) {
+		if (mode == "c") {
 			packbits_encoder encoder(input, output);
 			encoder.encode();
 		}
-		else {
+		else if (mode == "d") {
 			packbits_decoder decoder(input, output);
-			decoder.decode();
-		}	
+
+			if (!decoder.decode()) {
+				std::cout << "The input file is not a valid PackBits stream" << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (mode == "C") {
+			packbits_container_encoder encoder(input, output);
+			encoder.encode();
+		}
+		else {
+			packbits_container_decoder decoder(input);
+
+			if (!decoder.read_index()) {
+				std::cout << "The input file is not a valid PackBits container" << std::endl;
+				return EXIT_FAILURE;
+			}
+
+			bool valid = true;
+
+			if (mode == "D") {
+				valid = decoder.decode(output);
+			}
+			else {
+				auto range = decoder.read_range(std::stoull(argv[4]), std::stoull(argv[5]));
+
+				valid = range.second;
+				output.write(reinterpret_cast<const char*>(range.first.data()), range.first.size());
+			}
+
+			if (!valid) {
+				std::cout << "Cannot decode the requested data from the container" << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
 	}
 
 	//_CrtDumpMemoryLeaks();
 
 	return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
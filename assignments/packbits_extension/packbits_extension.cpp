@@ -3,13 +3,12 @@
 #include <cstdint>
 #include <vector>
 #include <iterator>
+#include <cstring>
+#include <algorithm>
+#include <utility>
 //#include <crtdbg.h>
 
-static std::pair<uint8_t, bool> raw_read(std::istream& input) {
-	uint8_t buffer = 0;
-	input.read(reinterpret_cast<char*>(&buffer), sizeof(buffer));
-	return std::pair<uint8_t, bool>(buffer, !input.eof());
-}
+#include "../../support/read_data/read_data.h"
 
 static void raw_write(const uint8_t& value, std::ostream& output) {
 	output.write(reinterpret_cast<const char*>(&value), sizeof(value));
@@ -24,16 +23,16 @@ private:
 			return;
 		}
 
-		// Only take up to 128 bytes from the buffer
-		uint8_t bytes_in_buffer = std::min<uint8_t>(static_cast<uint8_t>(buffer.size()), 128);
+		// Only take up to 128 bytes from the buffer for each copy
+		for (size_t begin = 0; begin < buffer.size(); begin += 128) {
+			size_t bytes_in_buffer = std::min<size_t>(buffer.size() - begin, 128);
 
-		// The copy is 0 based
-		uint8_t encoded_bytes_to_write = bytes_in_buffer - 1;
+			// The copy is 0 based
+			uint8_t encoded_bytes_to_write = static_cast<uint8_t>(bytes_in_buffer - 1);
 
-		raw_write(encoded_bytes_to_write, output);
+			raw_write(encoded_bytes_to_write, output);
 
-		for (const auto& container_item : buffer) {
-			raw_write(container_item, output);
+			output.write(reinterpret_cast<const char*>(buffer.data() + begin), bytes_in_buffer);
 		}
 
 		//std::cout << "COPY (" << buffer.size() << ", " << std::string(buffer.begin(), buffer.end()) << ")" << std::endl;
@@ -74,33 +73,30 @@ private:
 		}
 	}
 
-	void execute_copy(uint8_t command, std::istream& input, std::ostream& output) {
-		uint8_t bytes_to_read = command + 1;
-
-		for (int i = 0; i < bytes_to_read; ++i) {
-			auto read_byte = raw_read(input);
-
-			if (!read_byte.second) {
-				return;
-			}
-
-			raw_write(read_byte.first, output);
+	// Bytes of input taken by the argument of a command, the EOD has none
+	static size_t command_arguments(uint8_t command) {
+		if (command < 128) {
+			return command + 1;
 		}
-	}
 
-	void execute_run(uint8_t command, std::istream& input, std::ostream& output) {
+		return command == 128 ? 0 : 1;
+	}
 
-		uint8_t repetitons = 257 - command;
+	// Bytes of output produced by a command
+	static size_t command_output(uint8_t command) {
+		if (command < 128) {
+			return command + 1;
+		}
 
-		auto read_symbol = raw_read(input);
+		return command == 128 ? 0 : 257 - command;
+	}
 
-		if (!read_symbol.second) {
-			return;
-		}
+	void execute_copy(const uint8_t* input, size_t bytes, uint8_t* output) {
+		std::memcpy(output, input, bytes);
+	}
 
-		for (int i = 0; i < repetitons; ++i) {
-			raw_write(read_symbol.first, output);
-		}
+	void execute_run(uint8_t symbol, size_t repetitions, uint8_t* output) {
+		std::memset(output, symbol, repetitions);
 	}
 
 public:
@@ -169,25 +165,100 @@ public:
 		raw_write(128, output);
 	}
 
-	void decode(std::istream& input, std::ostream& output) {
+	// Validates the commands and returns the exact decoded size, false if the data is truncated
+	std::pair<size_t, bool> decoded_size(const uint8_t* data, size_t size) {
 
-		while (true) {
-			auto read_command = raw_read(input);
+		size_t decoded = 0;
+		size_t i = 0;
 
-			if (!read_command.second) {
-				break;
+		while (i < size) {
+
+			uint8_t command = data[i++];
+
+			if (command == 128) {
+				break; // EOD
 			}
 
-			if (read_command.first < 128) {
-				execute_copy(read_command.first, input, output);
+			size_t arguments = command_arguments(command);
+
+			if (size - i < arguments) {
+				return std::pair<size_t, bool>(decoded, false);
 			}
-			else if (read_command.first == 128) {
+
+			decoded += command_output(command);
+			i += arguments;
+		}
+
+		return std::pair<size_t, bool>(decoded, true);
+	}
+
+	// Decodes the data into output with a single allocation when preflight is set, growing it as needed otherwise.
+	// Returns false, leaving output with what was decoded so far, if the data is truncated.
+	bool decode(const uint8_t* data, size_t size, std::vector<uint8_t>& output, bool preflight = true) {
+
+		if (preflight) {
+			auto decoded = decoded_size(data, size);
+
+			if (!decoded.second) {
+				output.clear();
+				return false;
+			}
+
+			output.resize(decoded.first);
+		}
+
+		size_t written = 0;
+		size_t i = 0;
+		bool valid = true;
+
+		while (i < size) {
+
+			uint8_t command = data[i++];
+
+			if (command == 128) {
 				break; // EOD
 			}
+
+			size_t arguments = command_arguments(command);
+			size_t bytes = command_output(command);
+
+			if (size - i < arguments) {
+				valid = false;
+				break;
+			}
+
+			if (output.size() - written < bytes) {
+				output.resize(std::max(output.size() * 2, written + bytes));
+			}
+
+			if (command < 128) {
+				execute_copy(data + i, bytes, output.data() + written);
+			}
 			else {
-				execute_run(read_command.first, input, output);
+				execute_run(data[i], bytes, output.data() + written);
 			}
+
+			written += bytes;
+			i += arguments;
 		}
+
+		output.resize(written);
+
+		return valid;
+	}
+
+	bool decode(std::istream& input, std::ostream& output) {
+
+		std::vector<uint8_t> data = read_data(input);
+		std::vector<uint8_t> decoded;
+
+		if (!decode(data.data(), data.size(), decoded)) {
+			return false;
+		}
+
+		output.write(reinterpret_cast<const char*>(decoded.data()), decoded.size());
+
+		return true;
 	}
 };
 
@@ -230,7 +301,10 @@ int main(int argc, char* argv[]) {
 			packbits.encode(input, output);
 		}
 		else {
-			packbits.decode(input, output);
+			if (!packbits.decode(input, output)) {
+				std::cerr << "The input file is not a valid PackBits stream";
+				return EXIT_FAILURE;
+			}
 		}
 	}
 
@@ -3,6 +3,8 @@
 #include <cstdint>
 #include <vector>
 
+#include "../../support/netpbm/netpbm.h"
+
 template <typename T>
 T raw_read(std::istream& input, size_t size = sizeof(T)) {
 	T value = 0;
@@ -40,6 +42,7 @@ public:
 
 	uint64_t rows() const { return rows_; }
 	uint64_t columns() const { return columns_; }
+	const T* data() const { return data_.data(); }
 };
 
 static matrix<uint8_t> read_tiff(std::ifstream& input) {
@@ -114,22 +117,9 @@ static matrix<uint8_t> read_tiff(std::ifstream& input) {
 	return raster;
 }
 
-static void write_pam(std::ofstream& output, matrix<uint8_t> raster) {
-
-	output << "P7" << std::endl;
-	output << "WIDTH " << raster.columns() << std::endl;
-	output << "HEIGHT " << raster.rows() << std::endl;
-	output << "DEPTH " << 1 << std::endl;
-	output << "MAXVAL " << 255 << std::endl;
-	output << "TUPLTYPE " << "GRAYSCALE" << std::endl;
-	output << "ENDHDR" << std::endl;
-
-	for (uint64_t row = 0; row < raster.rows(); ++row) {
-		for (uint64_t col = 0; col < raster.columns(); ++col) {
-			uint8_t pixel = raster(row, col);
-			output.write(reinterpret_cast<char*>(&pixel), sizeof(pixel));
-		}
-	}
+static bool write_pam(std::ofstream& output, const matrix<uint8_t>& raster) {
+	auto header = netpbm::pam_header(static_cast<uint32_t>(raster.columns()), static_cast<uint32_t>(raster.rows()), 1, 255, "GRAYSCALE");
+	return netpbm::write(output, header, raster.data());
 }
 
 int main(int argc, char* argv[]) {
@@ -152,7 +142,9 @@ int main(int argc, char* argv[]) {
 		return EXIT_FAILURE;
 	}
 
-	write_pam(output, tiff_data);
+	if (!write_pam(output, tiff_data)) {
+		return EXIT_FAILURE;
+	}
 
 	return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -108,29 +108,42 @@ public:
 	}
 };
 
+// Process-wide, indexed by the (symbol, length) pairs the canonical codes are built from
+decoding::table_cache<std::vector<uint8_t>, hufstr::code_table>& hufstr::table_cache() {
+	static decoding::table_cache<std::vector<uint8_t>, code_table> cache(16);
+	return cache;
+}
+
 hufstr::hufstr() {
 
-	for (size_t i = 0; i < table.size(); i+=2) {
+	table_ = table_cache().get(table, [](const std::vector<uint8_t>& pairs) {
 
-		auto symbol = table[i];
-		auto length = table[i+1];
+		auto new_table = std::make_shared<code_table>();
 
-		auto& symbol_data = symbols_data_[symbol];
-		symbol_data.sym = symbol;
-		symbol_data.len = length;
+		for (size_t i = 0; i < pairs.size(); i+=2) {
 
-		sorted_symbol_data_.push_back(symbol_data);
-	}
+			auto symbol = pairs[i];
+			auto length = pairs[i+1];
 
-	uint8_t len = 0;
-	uint32_t code = 0;
-	for (auto& item : sorted_symbol_data_) {
-		auto& symbol_data = symbols_data_[item.get().sym];
-		code <<= (symbol_data.len - len);
-		len = symbol_data.len;
-		symbol_data.code = code;
-		++code;
-	}
+			auto& symbol_data = new_table->symbols_data[symbol];
+			symbol_data.sym = symbol;
+			symbol_data.len = length;
+
+			new_table->sorted_symbol_data.push_back(symbol_data);
+		}
+
+		uint8_t len = 0;
+		uint32_t code = 0;
+		for (auto& item : new_table->sorted_symbol_data) {
+			code <<= (item.len - len);
+			len = item.len;
+			item.code = code;
+			new_table->symbols_data[item.sym].code = code;
+			++code;
+		}
+
+		return std::shared_ptr<const code_table>(new_table);
+		});
 }
 
 std::vector<uint8_t> hufstr::compress(const std::string& s) const {
@@ -141,7 +154,7 @@ std::vector<uint8_t> hufstr::compress(const std::string& s) const {
 		bit_writer bit_writer(writer);
 
 		for (const auto& symbol : s) {
-			auto const& symbol_data = symbols_data_.at(symbol);
+			auto const& symbol_data = table_->symbols_data.at(symbol);
 			bit_writer.write_number(symbol_data.code, symbol_data.len);
 		}
 	}
@@ -177,9 +190,7 @@ std::string hufstr::decompress(const std::vector<uint8_t>& v) const {
 		read_code |= read_bit.first;
 		bits_in_code++;
 
-		for (auto& item : sorted_symbol_data_) {
-
-			const auto& symbol_data = item.get();
+		for (const auto& symbol_data : table_->sorted_symbol_data) {
 
 			if (read_code == symbol_data.code && bits_in_code == symbol_data.len) {
 				out_string.push_back(symbol_data.sym);
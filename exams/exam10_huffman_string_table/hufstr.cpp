@@ -105,8 +105,19 @@ public:
 	}
 };
 
+// Process-wide, indexed by the (symbol, length) pairs the canonical codes are built from
+decoding::table_cache<std::vector<uint8_t>, hufstr::code_table>& hufstr::table_cache() {
+	static decoding::table_cache<std::vector<uint8_t>, code_table> cache(16);
+	return cache;
+}
+
 hufstr::hufstr() {
 
+	// Without a complete table.bin the table stays empty: compress() throws out_of_range and decompress() returns
+	// an empty string
+	static const std::shared_ptr<const code_table> empty_table = std::make_shared<code_table>();
+	table_ = empty_table;
+
 	std::ifstream table("table.bin", std::ios::binary);
 
 	if (!table) {
@@ -123,6 +134,9 @@ hufstr::hufstr() {
 		return;
 	}
 
+	// The (symbol, length) pairs identify the table in the cache
+	std::vector<uint8_t> pairs;
+
 	for (size_t i = 0; i < table_size.first; ++i) {
 
 		auto symbol = raw_read<uint8_t>(table);
@@ -139,22 +153,35 @@ hufstr::hufstr() {
 			return;
 		}
 
-		auto& symbol_data = symbols_data_[symbol.first];
-		symbol_data.sym = symbol.first;
-		symbol_data.len = length.first;	
-
-		sorted_symbol_data_.push_back(symbol_data);
+		pairs.push_back(symbol.first);
+		pairs.push_back(length.first);
 	}
 
-	uint8_t len = 0;
-	uint32_t code = 0;
-	for (auto& item : sorted_symbol_data_) {
-		auto& symbol_data = symbols_data_[item.get().sym];
-		code <<= (symbol_data.len - len);
-		len = symbol_data.len;
-		symbol_data.code = code;
-		++code;
-	}
+	table_ = table_cache().get(pairs, [](const std::vector<uint8_t>& pairs) {
+
+		auto new_table = std::make_shared<code_table>();
+
+		for (size_t i = 0; i < pairs.size(); i += 2) {
+
+			auto& symbol_data = new_table->symbols_data[pairs[i]];
+			symbol_data.sym = pairs[i];
+			symbol_data.len = pairs[i + 1];
+
+			new_table->sorted_symbol_data.push_back(symbol_data);
+		}
+
+		uint8_t len = 0;
+		uint32_t code = 0;
+		for (auto& item : new_table->sorted_symbol_data) {
+			code <<= (item.len - len);
+			len = item.len;
+			item.code = code;
+			new_table->symbols_data[item.sym].code = code;
+			++code;
+		}
+
+		return std::shared_ptr<const code_table>(new_table);
+		});
 }
 
 std::vector<uint8_t> hufstr::compress(const std::string& s) const {
@@ -165,7 +192,7 @@ std::vector<uint8_t> hufstr::compress(const std::string& s) const {
 		bit_writer bit_writer(writer);
 
 		for (const auto& symbol : s) {
-			auto const& symbol_data = symbols_data_.at(symbol);
+			auto const& symbol_data = table_->symbols_data.at(symbol);
 			bit_writer.write_number(symbol_data.code, symbol_data.len);
 		}
 	}
@@ -201,9 +228,7 @@ std::string hufstr::decompress(const std::vector<uint8_t>& v) const {
 		read_code |= read_bit.first;
 		bits_in_code++;
 
-		for (auto& item : sorted_symbol_data_) {
-
-			const auto& symbol_data = item.get();
+		for (const auto& symbol_data : table_->sorted_symbol_data) {
 
 			if (read_code == symbol_data.code && bits_in_code == symbol_data.len) {
 				out_string.push_back(symbol_data.sym);
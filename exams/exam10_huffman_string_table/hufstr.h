@@ -4,6 +4,9 @@
 #include <vector>
 #include <cstdint>
 #include <unordered_map>
+#include <memory>
+
+#include "../../support/huffman/table_cache.h"
 
 class hufstr {
 private:
@@ -13,8 +16,15 @@ private:
         uint32_t code = 0;
     };
 
-    std::unordered_map<uint8_t, symbol_data> symbols_data_;
-    std::vector<std::reference_wrapper<symbol_data>> sorted_symbol_data_;
+    struct code_table {
+        std::unordered_map<uint8_t, symbol_data> symbols_data;
+        std::vector<symbol_data> sorted_symbol_data;
+    };
+
+    // Shared with every other hufstr built from the same table
+    std::shared_ptr<const code_table> table_;
+
+    static decoding::table_cache<std::vector<uint8_t>, code_table>& table_cache();
 
 public:
     hufstr();
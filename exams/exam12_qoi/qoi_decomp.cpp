@@ -5,6 +5,8 @@
 #include <array>
 #include <string>
 
+#include "../../support/netpbm/netpbm.h"
+
 using rgba = std::array<uint8_t, 4>;
 
 template<typename T>
@@ -224,12 +226,9 @@ public:
 	}
 };
 
-static void write_pam(const mat<rgba>& image, std::ostream& output) {
-
-	output << "P7\nWIDTH " << image.cols() << "\nHEIGHT " << image.rows() <<
-		"\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
-
-	output.write(image.rawdata(), image.rawsize());
+static bool write_pam(const mat<rgba>& image, std::ostream& output) {
+	auto header = netpbm::pam_header(static_cast<uint32_t>(image.cols()), static_cast<uint32_t>(image.rows()), 4, 255, "RGB_ALPHA");
+	return netpbm::write(output, header, image.rawdata());
 }
 
 int main(int argc, char* argv[])
@@ -247,7 +246,9 @@ int main(int argc, char* argv[])
 		return EXIT_FAILURE;
 	}
 
-	write_pam(image, output);
+	if (!write_pam(image, output)) {
+		return EXIT_FAILURE;
+	}
 
 	return EXIT_SUCCESS;
 }
\ No newline at end of file
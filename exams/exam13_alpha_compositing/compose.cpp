@@ -7,6 +7,10 @@
 #include <filesystem>
 #include <algorithm>
 
+#include "../../support/netpbm/netpbm.h"
+#include "../../support/thread_pool/thread_pool.h"
+#include "over.h"
+
 using pixel = std::array<uint8_t, 4>;
 
 template<typename T>
@@ -40,6 +44,9 @@ public:
 	uint64_t rows() const { return rows_; }
 	uint64_t columns() const { return columns_; }
 
+	T* data() { return data_.data(); }
+	const T* data() const { return data_.data(); }
+
 	auto begin() { return data_.begin(); }
 	auto end() { return data_.end(); }
 	const auto begin() const { return data_.begin(); }
@@ -49,113 +56,86 @@ public:
 class pam_image {
 private:
 
-	struct pam_header {
-		std::string magic_number;
-		uint64_t width = 0;
-		uint64_t height = 0;
-		uint64_t depth = 0;
-		uint64_t max_value = 0;
-		std::string tuple_type;
-	};
+	using pam_header = netpbm::header;
 
 	matrix<pixel> image_;
 	pam_header header_;
 
-public:
-	pam_image(std::string& file_name) {
-
-		std::ifstream input(file_name, std::ios::binary);
-
-		input >> header_.magic_number;
-
-		char comment_char = input.peek();
+	// The compositing works with alpha values from 0 to 255
+	void scale_alpha() {
 
-		if (comment_char == '#') {
-			std::string comment;
-			input >> comment;
+		if (header_.max_value == 255) {
+			return;
 		}
 
-		std::string width;
-		input >> width >> width;
-		header_.width = std::stoi(width);
-
-		std::string height;
-		input >> height >> height;
-		header_.height = std::stoi(height);
-
-		std::string depth;
-		input >> depth >> depth;
-		header_.depth = std::stoi(depth);
+		for (auto& pixel_data : image_) {
+			pixel_data[3] = static_cast<uint8_t>(pixel_data[3] * 255 / header_.max_value);
+		}
+	}
 
-		std::string max_value;
-		input >> max_value >> max_value;
-		header_.max_value = std::stoi(max_value);
+public:
+	pam_image(std::string& file_name) {
 
-		input >> header_.tuple_type >> header_.tuple_type;
+		bool loaded = netpbm::load(file_name, header_, [this](const pam_header& header) -> void* {
 
-		std::string end_of_header;
-		input >> end_of_header;
+			if (header.max_value > 255 || header.depth > 4) {
+				return nullptr;
+			}
 
-		input.ignore(1);
+			image_.resize(header.height, header.width);
+			return image_.data();
+		});
 
-		image_.resize(header_.height, header_.width);
+		if (!loaded) {
+			std::cerr << "Cannot load " << file_name << std::endl;
+			image_.resize(0, 0);
+			header_ = pam_header();
+			return;
+		}
 
-		if (header_.max_value > 255) {
-			std::cerr << "Max value greater than 255" << std::endl;
+		if (header_.depth == 4) {
+			scale_alpha();
 			return;
 		}
 
-		for (uint64_t row = 0; row < header_.height; ++row) {
-			for (uint64_t column = 0; column < header_.width; ++column) {
-				pixel pixel_data = {};
-				input.read(reinterpret_cast<char*>(&pixel_data), header_.depth);
+		// Spread the samples to 4 bytes per pixel, backwards so that they are read before being overwritten,
+		// and set the pixels as opaque
+		auto bytes = reinterpret_cast<uint8_t*>(image_.data());
 
-				if (header_.depth != 4) {
-					// Set the pixel as opaque
-					pixel_data[3] = static_cast<uint8_t>(header_.max_value);
-				}
-			
-				image_(row, column) = pixel_data;
-			}
+		for (size_t i = image_.rows() * image_.columns(); i-- > 0;) {
+			pixel pixel_data = {};
+			std::copy_n(bytes + i * header_.depth, header_.depth, pixel_data.begin());
+			pixel_data[3] = static_cast<uint8_t>(header_.max_value);
+			image_.data()[i] = pixel_data;
 		}
+
+		scale_alpha();
 	}
 
 	pam_image(const matrix<pixel>& raw_image, uint64_t depth) {
 
-		header_.magic_number = "P7";
-		header_.width = raw_image.columns();
-		header_.height = raw_image.rows();
-		header_.depth = depth;
-		header_.max_value = 255;
-		header_.tuple_type = depth == 3 ? "RGB" : "RGB_ALPHA";
+		header_ = netpbm::pam_header(static_cast<uint32_t>(raw_image.columns()), static_cast<uint32_t>(raw_image.rows()),
+			static_cast<uint32_t>(depth), 255, depth == 3 ? "RGB" : "RGB_ALPHA");
 
 		image_.resize(header_.height, header_.width);
 		std::copy(raw_image.begin(), raw_image.end(), image_.begin());
 	}
 
 	bool write(std::string& file_name) {
-		std::ofstream output(file_name, std::ios::binary);
 
-		if (!output) {
-			return false;
+		if (header_.depth == 4) {
+			return netpbm::write(file_name, header_, image_.data());
 		}
 
-		output << "P7" << std::endl;
-		output << "WIDTH " << header_.width << std::endl;
-		output << "HEIGHT " << header_.height << std::endl;
-		output << "DEPTH " << header_.depth << std::endl;
-		output << "MAXVAL " << header_.max_value << std::endl;
-		output << "TUPLTYPE " << header_.tuple_type << std::endl;
-		output << "ENDHDR" << std::endl;
-
-		for (uint64_t row = 0; row < header_.height; ++row) {
-			for (uint64_t column = 0; column < header_.width; ++column) {
-				const auto& pixel = image_(row, column);
-				output.write(reinterpret_cast<const char*>(&pixel), header_.depth);
-			}
+		// Only the first depth bytes of each pixel are written
+		std::vector<uint8_t> samples(header_.data_size());
+		auto output = samples.begin();
+
+		for (const auto& pixel : image_) {
+			output = std::copy_n(pixel.begin(), header_.depth, output);
 		}
 
-		return true;
+		return netpbm::write(file_name, header_, samples.data());
 	}
 
 	const pam_header& header() const { return header_; };
@@ -169,26 +149,53 @@ struct image_with_offset {
 	uint64_t y_offset = 0;
 };
 
-template<typename FROM, typename TO>
-static TO map(FROM value, FROM from_min, FROM from_max, TO to_min, TO to_max) {
-	double pos_percentage = static_cast<double>(value) / (from_max - from_min);
-	return static_cast<TO>((pos_percentage * to_max) - to_min);
-}
+// Canvas area from (left, top) included to (right, bottom) excluded
+struct rectangle {
+	uint64_t left = 0;
+	uint64_t top = 0;
+	uint64_t right = 0;
+	uint64_t bottom = 0;
 
-template<typename T>
-static T calculate_alpha_value(T alpha_a, T alpha_b, T max_value) {
-	return alpha_a + (alpha_b * (max_value - alpha_a));
+	bool empty() const { return left >= right || top >= bottom; }
+
+	rectangle intersection(const rectangle& other) const {
+		return { std::max(left, other.left), std::max(top, other.top),
+			std::min(right, other.right), std::min(bottom, other.bottom) };
+	}
+
+	bool contains(const rectangle& other) const {
+		return left <= other.left && top <= other.top && right >= other.right && bottom >= other.bottom;
+	}
+};
+
+static rectangle layer_area(const image_with_offset& layer) {
+	const auto& image_data = layer.image.image_data();
+	return { layer.x_offset, layer.y_offset, layer.x_offset + image_data.columns(), layer.y_offset + image_data.rows() };
 }
 
-template<typename T>
-static T calculate_color_value(T color_a, T alpha_a, T color_b,
-	T alpha_b, T alpha, T max_value) {
+// Whether the layer hides everything under it in the area, which must be inside the layer
+static bool is_opaque(const image_with_offset& layer, const rectangle& area) {
+
+	const auto& image_data = layer.image.image_data();
 
-	return ((color_a * alpha_a) + (color_b * alpha_b * (max_value - alpha_a))) / alpha;
+	for (uint64_t row = area.top; row < area.bottom; ++row) {
+		const pixel* first = &image_data(row - layer.y_offset, area.left - layer.x_offset);
+
+		if (!std::all_of(first, first + (area.right - area.left), [](const pixel& p) { return p[3] == 255; })) {
+			return false;
+		}
+	}
+
+	return true;
 }
 
+// The canvas is split in tiles composited independently of each other. Each tile only gets the layers that
+// touch it, starting from the topmost one that is opaque all over the tile, since "over" an opaque pixel gives
+// that pixel whatever is under it. Tiles without layers keep the background.
 static pam_image combine_images(const std::vector<image_with_offset>& images) {
 
+	static constexpr uint64_t tile_size = 256;
+
 	uint64_t max_width = 0;
 	uint64_t max_height = 0;
 
@@ -211,52 +218,72 @@ static pam_image combine_images(const std::vector<image_with_offset>& images) {
 	// This is by default a dark background
 	matrix<pixel> raw_image(max_height, max_width);
 
-	// Combine images
-	for (uint64_t i = 0; i < images.size(); ++i) {
+	uint64_t tile_columns = (max_width + tile_size - 1) / tile_size;
+	uint64_t tile_rows = (max_height + tile_size - 1) / tile_size;
 
-		const auto& current_image = images[i];
-		const auto& image_header = current_image.image.header();
-		const auto& image_data = current_image.image.image_data();
+	// Layers touching each tile, from the bottom to the top
+	std::vector<std::vector<size_t>> tile_layers(tile_columns * tile_rows);
 
-		uint8_t casted_max_value = static_cast<uint8_t>(image_header.max_value);
+	for (size_t i = 0; i < images.size(); ++i) {
+		rectangle area = layer_area(images[i]);
 
-		for (uint64_t row = 0; row < max_height; ++row) {
-			for (uint64_t column = 0; column < max_width; ++column) {
+		if (area.empty()) {
+			continue;
+		}
 
-				int64_t image_row = row - current_image.y_offset;
-				int64_t image_column = column - current_image.x_offset;
+		for (uint64_t tile_row = area.top / tile_size; tile_row <= (area.bottom - 1) / tile_size; ++tile_row) {
+			for (uint64_t tile_column = area.left / tile_size; tile_column <= (area.right - 1) / tile_size; ++tile_column) {
+				tile_layers[tile_row * tile_columns + tile_column].push_back(i);
+			}
+		}
+	}
 
-				if (row >= current_image.y_offset && column >= current_image.x_offset && 
-					image_row < image_data.rows() && image_column < image_data.columns()) {
+	thread_pool pool;
 
-					double red_a = image_data(image_row, image_column)[0];
-					double red_b = raw_image(row, column)[0];
+	pool.run(tile_layers.size(), [&](size_t tile) {
 
-					double green_a = image_data(image_row, image_column)[1];
-					double green_b = raw_image(row, column)[1];
+		const auto& layers = tile_layers[tile];
 
-					double blue_a = image_data(image_row, image_column)[2];
-					double blue_b = raw_image(row, column)[2];
-					
-					double alpha_a = map<uint8_t, double>(image_data(image_row, image_column)[3], 0, casted_max_value, 0, 1);
-					double alpha_b = map<uint8_t, double>(raw_image(row, column)[3], 0, casted_max_value, 0, 1);					
+		if (layers.empty()) {
+			return;
+		}
 
-					double alpha = calculate_alpha_value<double>(alpha_a, alpha_b, 1.0);
-					double red = calculate_color_value<double>(red_a, alpha_a, red_b, alpha_b, alpha, 1.0);
-					double green = calculate_color_value<double>(green_a, alpha_a, green_b, alpha_b, alpha, 1.0);
-					double blue = calculate_color_value<double>(blue_a, alpha_a, blue_b, alpha_b, alpha, 1.0);
+		uint64_t left = tile % tile_columns * tile_size;
+		uint64_t top = tile / tile_columns * tile_size;
+		rectangle tile_area = { left, top, std::min(left + tile_size, max_width), std::min(top + tile_size, max_height) };
 
-					uint8_t calculated_red = static_cast<uint8_t>(red);
-					uint8_t calculated_green = static_cast<uint8_t>(green);
-					uint8_t calculated_blue = static_cast<uint8_t>(blue);
+		size_t first_layer = 0;
+		bool opaque = false;
 
-					uint8_t calculated_alpha = map<double, uint8_t>(alpha, 0, 1, 0, casted_max_value);
+		for (size_t i = layers.size(); i-- > 0;) {
+			const auto& layer = images[layers[i]];
 
-					raw_image(row, column) = { calculated_red, calculated_green, calculated_blue, calculated_alpha };
+			if (layer_area(layer).contains(tile_area) && is_opaque(layer, tile_area)) {
+				first_layer = i;
+				opaque = true;
+				break;
+			}
+		}
+
+		for (size_t i = first_layer; i < layers.size(); ++i) {
+			const auto& layer = images[layers[i]];
+			const auto& image_data = layer.image.image_data();
+			rectangle area = layer_area(layer).intersection(tile_area);
+			uint64_t width = area.right - area.left;
+
+			for (uint64_t row = area.top; row < area.bottom; ++row) {
+				const pixel& layer_row = image_data(row - layer.y_offset, area.left - layer.x_offset);
+				pixel& canvas_row = raw_image(row, area.left);
+
+				if (opaque && i == first_layer) {
+					std::copy_n(&layer_row, width, &canvas_row);
+				}
+				else {
+					composite_over(layer_row.data(), canvas_row.data(), width);
 				}
 			}
 		}
-	}
+	});
 
 	return pam_image(raw_image, 4);
 }
@@ -0,0 +1,96 @@
+#include "over.h"
+
+#include "../../support/cpu_features/cpu_features.h"
+
+static void composite_over_scalar(const uint8_t* layer, uint8_t* canvas, size_t count) {
+
+	for (size_t i = 0; i < count; ++i, layer += 4, canvas += 4) {
+		uint32_t layer_weight = 255 * layer[3];
+		uint32_t canvas_weight = (255 - layer[3]) * canvas[3];
+		uint32_t total = layer_weight + canvas_weight;
+
+		if (total == 0) {
+			canvas[0] = canvas[1] = canvas[2] = canvas[3] = 0;
+			continue;
+		}
+
+		for (int c = 0; c < 3; ++c) {
+			canvas[c] = static_cast<uint8_t>((layer_weight * layer[c] + canvas_weight * canvas[c]) / total);
+		}
+
+		canvas[3] = static_cast<uint8_t>(total / 255);
+	}
+}
+
+#if defined(CPU_X86)
+
+// The products and sums above stay below 2^24, so they are exact in single precision, and a correctly rounded
+// quotient truncates to the same integer as the exact one: the numerators are integers and the divisors at most
+// 65025, so a quotient below an integer is at least 1/65025 away from it, more than half the spacing of floats
+// under 256.
+
+CPU_TARGET("avx2")
+static __m256i blend_channel(__m256i top, __m256i bottom, __m256 layer_weight, __m256 canvas_weight, __m256 total) {
+
+	const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+
+	__m256 top_color = _mm256_cvtepi32_ps(_mm256_and_si256(top, byte_mask));
+	__m256 bottom_color = _mm256_cvtepi32_ps(_mm256_and_si256(bottom, byte_mask));
+	__m256 sum = _mm256_add_ps(_mm256_mul_ps(layer_weight, top_color), _mm256_mul_ps(canvas_weight, bottom_color));
+
+	return _mm256_cvttps_epi32(_mm256_div_ps(sum, total));
+}
+
+// 8 pixels at a time, one in each 32 bit lane. Returns the number of pixels done.
+CPU_TARGET("avx2")
+static size_t composite_over_avx2(const uint8_t* layer, uint8_t* canvas, size_t count) {
+
+	const __m256 max_value = _mm256_set1_ps(255.0f);
+	const __m256 one = _mm256_set1_ps(1.0f);
+
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m256i top = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(layer + i * 4));
+		__m256i bottom = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(canvas + i * 4));
+
+		__m256 top_alpha = _mm256_cvtepi32_ps(_mm256_srli_epi32(top, 24));
+		__m256 bottom_alpha = _mm256_cvtepi32_ps(_mm256_srli_epi32(bottom, 24));
+
+		__m256 layer_weight = _mm256_mul_ps(max_value, top_alpha);
+		__m256 canvas_weight = _mm256_mul_ps(_mm256_sub_ps(max_value, top_alpha), bottom_alpha);
+		__m256 total = _mm256_add_ps(layer_weight, canvas_weight);
+
+		// Where total is 0 all the numerators are 0 too, dividing them by 1 gives the transparent black pixel
+		__m256 divisor = _mm256_max_ps(total, one);
+
+		__m256i red = blend_channel(top, bottom, layer_weight, canvas_weight, divisor);
+		__m256i green = blend_channel(_mm256_srli_epi32(top, 8), _mm256_srli_epi32(bottom, 8),
+			layer_weight, canvas_weight, divisor);
+		__m256i blue = blend_channel(_mm256_srli_epi32(top, 16), _mm256_srli_epi32(bottom, 16),
+			layer_weight, canvas_weight, divisor);
+		__m256i alpha = _mm256_cvttps_epi32(_mm256_div_ps(total, max_value));
+
+		__m256i pixels = _mm256_or_si256(_mm256_or_si256(red, _mm256_slli_epi32(green, 8)),
+			_mm256_or_si256(_mm256_slli_epi32(blue, 16), _mm256_slli_epi32(alpha, 24)));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(canvas + i * 4), pixels);
+	}
+
+	return i;
+}
+
+#endif
+
+void composite_over(const uint8_t* layer, uint8_t* canvas, size_t count) {
+
+	size_t done = 0;
+
+#if defined(CPU_X86)
+	if (cpu_features::has_avx2()) {
+		done = composite_over_avx2(layer, canvas, count);
+	}
+#endif
+
+	composite_over_scalar(layer + done * 4, canvas + done * 4, count - done);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Puts count RGBA pixels (straight alpha, max value 255) of a layer over the ones of the canvas, in place.
+// The colors are premultiplied, added and divided back by the resulting alpha, every value rounded down:
+//   alpha = (255 a + (255 - a) b) / 255
+//   color = (255 a top + (255 - a) b bottom) / (255 a + (255 - a) b)
+// where a and b are the alphas of the layer and of the canvas. Where both are 0 the result is all 0.
+void composite_over(const uint8_t* layer, uint8_t* canvas, size_t count);
@@ -1,254 +1,203 @@
 #include <fstream>
 #include <iostream>
 #include <cstdint>
-#include <map>
 #include <vector>
-#include <sstream>
 #include <array>
-#include <cmath>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "../../support/thread_pool/thread_pool.h"
 
 using pixel = std::array<uint8_t, 3>;
 
 class z85 {
 private:
 
-	std::vector<uint8_t> index_to_symbol_map_ = {
-		'0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
-		'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j',
-		'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't',
-		'u', 'v', 'w', 'x', 'y', 'z', 'A', 'B', 'C', 'D',
-		'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N',
-		'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X',
-		'Y', 'Z', '.', '-', ':', '+', '=', '^', '!', '/',
-		'*', '?', '&', '<', '>', '(', ')', '[', ']', '{',
-		'}', '@', '%', '$', '#'
-	};
+	static constexpr char alphabet_[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ.-:+=^!/*?&<>()[]{}@%$#";
 
-	std::map<uint8_t, uint8_t> symbols_to_index_map_{
-		std::pair<uint8_t, uint32_t>('0', 0),
-		std::pair<uint8_t, uint32_t>('1', 1),
-		std::pair<uint8_t, uint32_t>('2', 2),
-		std::pair<uint8_t, uint32_t>('3', 3),
-		std::pair<uint8_t, uint32_t>('4', 4),
-		std::pair<uint8_t, uint32_t>('5', 5),
-		std::pair<uint8_t, uint32_t>('6', 6),
-		std::pair<uint8_t, uint32_t>('7', 7),
-		std::pair<uint8_t, uint32_t>('8', 8),
-		std::pair<uint8_t, uint32_t>('9', 9),
-
-		std::pair<uint8_t, uint32_t>('a', 10),
-		std::pair<uint8_t, uint32_t>('b', 11),
-		std::pair<uint8_t, uint32_t>('c', 12),
-		std::pair<uint8_t, uint32_t>('d', 13),
-		std::pair<uint8_t, uint32_t>('e', 14),
-		std::pair<uint8_t, uint32_t>('f', 15),
-		std::pair<uint8_t, uint32_t>('g', 16),
-		std::pair<uint8_t, uint32_t>('h', 17),
-		std::pair<uint8_t, uint32_t>('i', 18),
-		std::pair<uint8_t, uint32_t>('j', 19),
-
-		std::pair<uint8_t, uint32_t>('k', 20),
-		std::pair<uint8_t, uint32_t>('l', 21),
-		std::pair<uint8_t, uint32_t>('m', 22),
-		std::pair<uint8_t, uint32_t>('n', 23),
-		std::pair<uint8_t, uint32_t>('o', 24),
-		std::pair<uint8_t, uint32_t>('p', 25),
-		std::pair<uint8_t, uint32_t>('q', 26),
-		std::pair<uint8_t, uint32_t>('r', 27),
-		std::pair<uint8_t, uint32_t>('s', 28),
-		std::pair<uint8_t, uint32_t>('t', 29),
-
-		std::pair<uint8_t, uint32_t>('u', 30),
-		std::pair<uint8_t, uint32_t>('v', 31),
-		std::pair<uint8_t, uint32_t>('w', 32),
-		std::pair<uint8_t, uint32_t>('x', 33),
-		std::pair<uint8_t, uint32_t>('y', 34),
-		std::pair<uint8_t, uint32_t>('z', 35),
-		std::pair<uint8_t, uint32_t>('A', 36),
-		std::pair<uint8_t, uint32_t>('B', 37),
-		std::pair<uint8_t, uint32_t>('C', 38),
-		std::pair<uint8_t, uint32_t>('D', 39),
-
-		std::pair<uint8_t, uint32_t>('E', 40),
-		std::pair<uint8_t, uint32_t>('F', 41),
-		std::pair<uint8_t, uint32_t>('G', 42),
-		std::pair<uint8_t, uint32_t>('H', 43),
-		std::pair<uint8_t, uint32_t>('I', 44),
-		std::pair<uint8_t, uint32_t>('J', 45),
-		std::pair<uint8_t, uint32_t>('K', 46),
-		std::pair<uint8_t, uint32_t>('L', 47),
-		std::pair<uint8_t, uint32_t>('M', 48),
-		std::pair<uint8_t, uint32_t>('N', 49),
-
-		std::pair<uint8_t, uint32_t>('O', 50),
-		std::pair<uint8_t, uint32_t>('P', 51),
-		std::pair<uint8_t, uint32_t>('Q', 52),
-		std::pair<uint8_t, uint32_t>('R', 53),
-		std::pair<uint8_t, uint32_t>('S', 54),
-		std::pair<uint8_t, uint32_t>('T', 55),
-		std::pair<uint8_t, uint32_t>('U', 56),
-		std::pair<uint8_t, uint32_t>('V', 57),
-		std::pair<uint8_t, uint32_t>('W', 58),
-		std::pair<uint8_t, uint32_t>('X', 59),
-
-		std::pair<uint8_t, uint32_t>('Y', 60),
-		std::pair<uint8_t, uint32_t>('Z', 61),
-		std::pair<uint8_t, uint32_t>('.', 62),
-		std::pair<uint8_t, uint32_t>('-', 63),
-		std::pair<uint8_t, uint32_t>(':', 64),
-		std::pair<uint8_t, uint32_t>('+', 65),
-		std::pair<uint8_t, uint32_t>('=', 66),
-		std::pair<uint8_t, uint32_t>('^', 67),
-		std::pair<uint8_t, uint32_t>('!', 68),
-		std::pair<uint8_t, uint32_t>('/', 69),
-
-		std::pair<uint8_t, uint32_t>('*', 70),
-		std::pair<uint8_t, uint32_t>('?', 71),
-		std::pair<uint8_t, uint32_t>('&', 72),
-		std::pair<uint8_t, uint32_t>('<', 73),
-		std::pair<uint8_t, uint32_t>('>', 74),
-		std::pair<uint8_t, uint32_t>('(', 75),
-		std::pair<uint8_t, uint32_t>(')', 76),
-		std::pair<uint8_t, uint32_t>('[', 77),
-		std::pair<uint8_t, uint32_t>(']', 78),
-		std::pair<uint8_t, uint32_t>('{', 79),
-
-		std::pair<uint8_t, uint32_t>('}', 80),
-		std::pair<uint8_t, uint32_t>('@', 81),
-		std::pair<uint8_t, uint32_t>('%', 82),
-		std::pair<uint8_t, uint32_t>('$', 83),
-		std::pair<uint8_t, uint32_t>('#', 84)
-	};
+	static constexpr uint8_t invalid_symbol_ = 0xFF;
+
+	// The alphabet repeated twice: a symbol index rotated back by r < 85 is symbols_[index + 85 - r]
+	static constexpr std::array<uint8_t, 170> symbols_ = [] {
+		std::array<uint8_t, 170> symbols{};
+
+		for (size_t i = 0; i < symbols.size(); ++i) {
+			symbols[i] = alphabet_[i % 85];
+		}
 
-	std::vector<uint8_t> convert_to_base85(uint32_t value) {
+		return symbols;
+	}();
 
-		std::vector<uint8_t> result(5);
+	static constexpr std::array<uint8_t, 256> symbol_indices_ = [] {
+		std::array<uint8_t, 256> indices{};
 
-		int index = 4;
+		indices.fill(invalid_symbol_);
 
-		while (value > 0) {
-			uint32_t div = value / 85;
-			uint32_t mod = value % 85;
-			result[index] = mod;
-			index--;
-			value = div;
+		for (uint8_t i = 0; i < 85; ++i) {
+			indices[static_cast<uint8_t>(alphabet_[i])] = i;
 		}
 
-		return result;
-	}
+		return indices;
+	}();
 
-	uint32_t convert_from_base85(const std::vector<uint8_t>& values) {
-		
-		uint32_t value = 0;
+	// Values in [0, 170) reduced mod 85: a symbol index rotated forward by r < 85 is reduced_[index + r]
+	static constexpr std::array<uint8_t, 170> reduced_ = [] {
+		std::array<uint8_t, 170> reduced{};
 
-		for (size_t i = 0; i < values.size(); ++i) {
-			value += std::pow(85, values.size() - 1 - i) * values[i];
+		for (size_t i = 0; i < reduced.size(); ++i) {
+			reduced[i] = static_cast<uint8_t>(i % 85);
 		}
 
-		return value;
+		return reduced;
+	}();
+
+	// The rotation of the symbol i is N * i mod 85, kept in [0, 85) adding N mod 85 for every symbol.
+	// It only depends on the position, so it can start from any symbol.
+	class rotation {
+		uint32_t step_;
+		uint32_t value_;
+	public:
+		rotation(int32_t N, size_t first_symbol = 0) : step_(static_cast<uint32_t>((N % 85 + 85) % 85)),
+			value_(static_cast<uint32_t>(step_ * (first_symbol % 85) % 85)) {}
+
+		uint32_t next() {
+			uint32_t current = value_;
+			value_ += step_;
+
+			if (value_ >= 85) {
+				value_ -= 85;
+			}
+
+			return current;
+		}
+	};
+
+	// Exact for every 32 bits value: 0xC0C0C0C1 is 2^38 / 85 rounded up
+	static uint32_t divide_by_85(uint32_t value) {
+		return static_cast<uint32_t>((static_cast<uint64_t>(value) * 0xC0C0C0C1u) >> 38);
 	}
 
-public:
+	// Frames processed by each task, every chunk is encoded in its own slice of the output
+	static constexpr size_t chunk_frames_ = 1 << 18;
 
-	std::string encode(const std::vector<uint8_t>& binary_frame, int32_t N) {
+	thread_pool pool_;
+
+	// Encodes frames 4 bytes frames, the first one being the frame first_frame of the whole data
+	static void encode_frames(const uint8_t* input, size_t frames, char* output, int32_t N, size_t first_frame) {
+
+		rotation rotation(N, first_frame * 5);
 
-		std::ostringstream output_string;
+		for (size_t i = 0; i < frames; ++i, input += 4, output += 5) {
 
-		// Encoding binary frame
-		for (size_t i = 0; i < binary_frame.size(); i += 4) {
+			uint32_t value = input[0] << 24 | input[1] << 16 | input[2] << 8 | input[3];
 
-			uint32_t value = binary_frame[i] << 24 |
-				binary_frame[i + 1] << 16 |
-				binary_frame[i + 2] << 8 |
-				binary_frame[i + 3] << 0;
+			// Base 85 digits, from the least significant
+			uint8_t digits[5];
+
+			for (int digit = 4; digit > 0; --digit) {
+				uint32_t quotient = divide_by_85(value);
+				digits[digit] = static_cast<uint8_t>(value - quotient * 85);
+				value = quotient;
+			}
 
-			auto converted_value_digits = convert_to_base85(value);
+			digits[0] = static_cast<uint8_t>(value);
 
-			for (auto& digit : converted_value_digits) {
-				output_string << index_to_symbol_map_[digit];
+			// Encryption
+			for (int digit = 0; digit < 5; ++digit) {
+				output[digit] = symbols_[digits[digit] + 85 - rotation.next()];
 			}
 		}
+	}
 
-		std::string encoded_string = output_string.str();
+	// Decodes frames groups of 5 symbols, the first one being the frame first_frame of the whole data
+	static bool decode_frames(const uint8_t* input, size_t frames, uint8_t* output, int32_t N, size_t first_frame) {
 
-		// Encryption
-		for (size_t i = 0; i < encoded_string.size(); ++i) {
+		rotation rotation(N, first_frame * 5);
 
-			uint8_t symbol = encoded_string[i];
-			int symbol_index = symbols_to_index_map_[symbol];
-			int new_symbol_index = symbol_index - (N * i);
+		for (size_t i = 0; i < frames; ++i, input += 5, output += 4) {
 
-			int adapted_new_symbol_index = new_symbol_index;
+			uint64_t value = 0;
 
-			if (new_symbol_index < 0) {
-				int offset = std::abs(new_symbol_index) % index_to_symbol_map_.size();
+			for (int digit = 0; digit < 5; ++digit) {
+				uint8_t index = symbol_indices_[input[digit]];
 
-				if (offset == 0) {
-					adapted_new_symbol_index = 0;
+				if (index == invalid_symbol_) {
+					return false;
 				}
-				else {
-					adapted_new_symbol_index = index_to_symbol_map_.size() - offset;
-				}	
+
+				// Decryption
+				value = value * 85 + reduced_[index + rotation.next()];
 			}
 
-			uint8_t new_symbol = index_to_symbol_map_[static_cast<uint8_t>(adapted_new_symbol_index)];
-			encoded_string[i] = new_symbol;
+			if (value > 0xFFFFFFFF) {
+				return false;
+			}
+
+			output[0] = static_cast<uint8_t>(value >> 24);
+			output[1] = static_cast<uint8_t>(value >> 16);
+			output[2] = static_cast<uint8_t>(value >> 8);
+			output[3] = static_cast<uint8_t>(value);
 		}
 
-		return encoded_string;
+		return true;
 	}
 
-	std::vector<uint8_t> decode(const std::string& data, int32_t N) {
+public:
 
-		// Decryption
-		std::string decrypted_string(data);
+	z85(size_t threads = std::thread::hardware_concurrency()) : pool_(threads) {}
 
-		for (size_t i = 0; i < decrypted_string.size(); ++i) {
+	// The frame is encoded 4 bytes at a time, the caller pads it to a multiple of 4
+	std::string encode(const std::vector<uint8_t>& binary_frame, int32_t N) {
 
-			uint8_t symbol = decrypted_string[i];
-			int symbol_index = symbols_to_index_map_[symbol];
-			int new_symbol_index = symbol_index + (N * i);
+		size_t frames = binary_frame.size() / 4;
+		size_t chunks = (frames + chunk_frames_ - 1) / chunk_frames_;
 
-			int adapted_new_symbol_index = new_symbol_index;
+		std::string encoded_string(frames * 5, '\0');
 
-			if (new_symbol_index >= symbols_to_index_map_.size()) {
-				int offset = std::abs(new_symbol_index) % index_to_symbol_map_.size();
-				adapted_new_symbol_index = offset;
-			}
+		pool_.run(chunks, [&](size_t chunk) {
+			size_t first_frame = chunk * chunk_frames_;
+			size_t chunk_size = std::min(chunk_frames_, frames - first_frame);
 
-			uint8_t new_symbol = index_to_symbol_map_[static_cast<uint8_t>(adapted_new_symbol_index)];
-			decrypted_string[i] = new_symbol;
-		}
+			encode_frames(binary_frame.data() + first_frame * 4, chunk_size, encoded_string.data() + first_frame * 5, N, first_frame);
+		});
+
+		return encoded_string;
+	}
+
+	// False if the data contains symbols outside the alphabet, is not made of groups of 5 symbols,
+	// or a group is larger than 32 bits
+	std::pair<std::vector<uint8_t>, bool> decode(const std::string& data, int32_t N) {
 
 		std::vector<uint8_t> binary_frame;
 
-		// Decode binary frame
-		for (size_t i = 0; i < decrypted_string.size(); i += 5) {
+		if (data.size() % 5 != 0) {
+			return std::make_pair(binary_frame, false);
+		}
+
+		size_t frames = data.size() / 5;
+		size_t chunks = (frames + chunk_frames_ - 1) / chunk_frames_;
 
-			std::vector<uint8_t> base85_digits = {
-				symbols_to_index_map_[decrypted_string[i]],
-				symbols_to_index_map_[decrypted_string[i + 1]],
-				symbols_to_index_map_[decrypted_string[i + 2]],
-				symbols_to_index_map_[decrypted_string[i + 3]],
-				symbols_to_index_map_[decrypted_string[i + 4]]
-			};
-			
-			uint32_t base10_value = convert_from_base85(base85_digits);
+		binary_frame.resize(frames * 4);
 
-			uint8_t byte1 = (base10_value >> 24) & 0b11111111;
-			binary_frame.push_back(byte1);
+		std::atomic<bool> valid = true;
 
-			uint8_t byte2 = (base10_value >> 16) & 0b11111111;
-			binary_frame.push_back(byte2);
+		pool_.run(chunks, [&](size_t chunk) {
+			size_t first_frame = chunk * chunk_frames_;
+			size_t chunk_size = std::min(chunk_frames_, frames - first_frame);
 
-			uint8_t byte3 = (base10_value >> 8) & 0b11111111;
-			binary_frame.push_back(byte3);
+			if (!decode_frames(reinterpret_cast<const uint8_t*>(data.data()) + first_frame * 5, chunk_size,
+				binary_frame.data() + first_frame * 4, N, first_frame)) {
+				valid = false;
+			}
+		});
 
-			uint8_t byte4 = (base10_value >> 0) & 0b11111111;
-			binary_frame.push_back(byte4);
+		if (!valid) {
+			return std::make_pair(std::vector<uint8_t>(), false);
 		}
 
-		return binary_frame;
+		return std::make_pair(std::move(binary_frame), true);
 	}
 };
 
@@ -297,7 +246,7 @@ public:
 
 		data_.resize(header_.width * header_.height * sizeof(pixel));
 
-		input.read(reinterpret_cast<char*>(data_.data()), sizeof(pixel) * data_.size());
+		input.read(reinterpret_cast<char*>(data_.data()), data_.size());
 	}
 
 	ppm(const ppm_header& header, const std::vector<uint8_t>& data) : header_(header), data_(data) { }
@@ -389,7 +338,14 @@ int main(int argc, char* argv[]) {
 		std::string encoded_data;
 		input >> encoded_data;
 
-		std::vector<uint8_t> binary_frame = z85.decode(encoded_data, N);
+		auto decoded = z85.decode(encoded_data, N);
+
+		if (!decoded.second) {
+			std::cerr << "The input file is not valid Z85";
+			return EXIT_FAILURE;
+		}
+
+		std::vector<uint8_t>& binary_frame = decoded.first;
 
 		// Remove padding
 		size_t original_size = header.width * header.height * sizeof(pixel);
@@ -0,0 +1,488 @@
+#include "demosaic.h"
+#include "../../support/planar/planar.h"
+#include "../../support/cpu_features/cpu_features.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
+// In the RG/GB pattern the green samples are on the odd columns of the even rows and on the even columns of the
+// odd rows. The even rows have red as the other color, the odd rows blue.
+static int64_t green_parity(int64_t row) {
+	return (row & 1) ^ 1;
+}
+
+template<typename T>
+static T saturate_value(int32_t value, int32_t max_value) {
+	if (value > max_value) {
+		return static_cast<T>(max_value);
+	}
+	else if (value < 0) {
+		return 0;
+	}
+	else {
+		return static_cast<T>(value);
+	}
+}
+
+// Interpolation along the direction with the smallest gradient, or along both when they are equal. For each one
+// a and b are the neighbours being interpolated and d the second difference of the other channel along it.
+static int32_t directional(int32_t a1, int32_t b1, int32_t d1, int32_t a2, int32_t b2, int32_t d2) {
+
+	int32_t gradient1 = std::abs(a1 - b1) + std::abs(d1);
+	int32_t gradient2 = std::abs(a2 - b2) + std::abs(d2);
+
+	if (gradient1 < gradient2) {
+		return (a1 + b1) / 2 + d1 / 4;
+	}
+	else if (gradient1 > gradient2) {
+		return (a2 + b2) / 2 + d2 / 4;
+	}
+	else {
+		return (a1 + b1 + a2 + b2) / 4 + (d1 + d2) / 8;
+	}
+}
+
+// The kernels get the mosaic rows from 2 above to 2 below the one interpolated and the green rows from 1 above to
+// 1 below, all with the border of zeros
+
+// Green of a row from col on: the samples of the other color get it from their horizontal or vertical neighbours
+template<typename T>
+static void interpolate_green_scalar(const T* const* mosaic, int64_t row, int64_t cols, int64_t col, T max_value, T* green) {
+
+	const T* above2 = mosaic[0];
+	const T* above = mosaic[1];
+	const T* center = mosaic[2];
+	const T* below = mosaic[3];
+	const T* below2 = mosaic[4];
+
+	int64_t parity = green_parity(row);
+
+	for (; col < cols; ++col) {
+
+		if ((col & 1) == parity) {
+			green[col] = center[col];
+			continue;
+		}
+
+		int32_t x5 = center[col];
+
+		green[col] = saturate_value<T>(directional(center[col - 1], center[col + 1], x5 - center[col - 2] + x5 - center[col + 2],
+			above[col], below[col], x5 - above2[col] + x5 - below2[col]), max_value);
+	}
+}
+
+// Red and blue of a row from col on: on the green samples they are the average of the horizontal and vertical
+// neighbours, on the other color the diagonal ones are interpolated guided by the green
+template<typename T>
+static void interpolate_red_blue_scalar(const T* const* mosaic, const T* const* greens, int64_t row,
+	int64_t cols, int64_t col, T max_value, T* red, T* blue) {
+
+	const T* above = mosaic[1];
+	const T* center = mosaic[2];
+	const T* below = mosaic[3];
+
+	const T* green_above = greens[0];
+	const T* green = greens[1];
+	const T* green_below = greens[2];
+
+	int64_t parity = green_parity(row);
+	T* row_color = parity ? red : blue;
+	T* other_color = parity ? blue : red;
+
+	for (; col < cols; ++col) {
+
+		if ((col & 1) == parity) {
+			row_color[col] = static_cast<T>((center[col - 1] + center[col + 1]) / 2);
+			other_color[col] = static_cast<T>((above[col] + below[col]) / 2);
+			continue;
+		}
+
+		int32_t g5 = green[col];
+
+		row_color[col] = center[col];
+		other_color[col] = saturate_value<T>(directional(
+			above[col - 1], below[col + 1], g5 - green_above[col - 1] + g5 - green_below[col + 1],
+			above[col + 1], below[col - 1], g5 - green_above[col + 1] + g5 - green_below[col - 1]), max_value);
+	}
+}
+
+#if defined(CPU_X86)
+
+// The AVX2 versions compute a block of samples at a time, widened to lanes twice their size where all the values
+// fit: 16 samples of 8 bits in 16 bit lanes, or 8 samples of 16 bits in 32 bit lanes. The formula is applied to
+// every lane and the green sites are then selected with a byte mask, so the two phases of a row take no branches.
+// They return the number of columns done, the rest is left to the scalar code.
+
+// Signed divisions rounding toward zero, as in C++
+CPU_TARGET("avx2")
+static __m256i divide_by_4_epi16(__m256i value) {
+	__m256i bias = _mm256_and_si256(_mm256_srai_epi16(value, 15), _mm256_set1_epi16(3));
+	return _mm256_srai_epi16(_mm256_add_epi16(value, bias), 2);
+}
+
+CPU_TARGET("avx2")
+static __m256i divide_by_8_epi16(__m256i value) {
+	__m256i bias = _mm256_and_si256(_mm256_srai_epi16(value, 15), _mm256_set1_epi16(7));
+	return _mm256_srai_epi16(_mm256_add_epi16(value, bias), 3);
+}
+
+CPU_TARGET("avx2")
+static __m256i divide_by_4_epi32(__m256i value) {
+	__m256i bias = _mm256_and_si256(_mm256_srai_epi32(value, 31), _mm256_set1_epi32(3));
+	return _mm256_srai_epi32(_mm256_add_epi32(value, bias), 2);
+}
+
+CPU_TARGET("avx2")
+static __m256i divide_by_8_epi32(__m256i value) {
+	__m256i bias = _mm256_and_si256(_mm256_srai_epi32(value, 31), _mm256_set1_epi32(7));
+	return _mm256_srai_epi32(_mm256_add_epi32(value, bias), 3);
+}
+
+struct avx2_samples8 {
+	static constexpr int64_t count = 16;
+
+	CPU_TARGET("avx2")
+	static __m256i load(const uint8_t* samples) {
+		return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples)));
+	}
+
+	// Back to samples, clamped to max_value
+	CPU_TARGET("avx2")
+	static __m128i pack(__m256i values, __m128i max_value) {
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(values, values), 0xD8);
+		return _mm_min_epu8(_mm256_castsi256_si128(packed), max_value);
+	}
+
+	CPU_TARGET("avx2")
+	static __m128i broadcast(uint8_t value) {
+		return _mm_set1_epi8(static_cast<char>(value));
+	}
+
+	// Byte mask of the green sites of a row, the blocks start on even columns
+	CPU_TARGET("avx2")
+	static __m128i green_sites(int64_t row) {
+		return _mm_set1_epi16(green_parity(row) ? static_cast<short>(0xFF00) : 0x00FF);
+	}
+
+	// 2 a - b - c
+	CPU_TARGET("avx2")
+	static __m256i second_difference(__m256i a, __m256i b, __m256i c) {
+		return _mm256_sub_epi16(_mm256_sub_epi16(_mm256_add_epi16(a, a), b), c);
+	}
+
+	CPU_TARGET("avx2")
+	static __m256i average(__m256i a, __m256i b) {
+		return _mm256_srli_epi16(_mm256_add_epi16(a, b), 1);
+	}
+
+	CPU_TARGET("avx2")
+	static __m256i directional(__m256i a1, __m256i b1, __m256i d1, __m256i a2, __m256i b2, __m256i d2) {
+
+		__m256i gradient1 = _mm256_add_epi16(_mm256_abs_epi16(_mm256_sub_epi16(a1, b1)), _mm256_abs_epi16(d1));
+		__m256i gradient2 = _mm256_add_epi16(_mm256_abs_epi16(_mm256_sub_epi16(a2, b2)), _mm256_abs_epi16(d2));
+
+		__m256i sum1 = _mm256_add_epi16(a1, b1);
+		__m256i sum2 = _mm256_add_epi16(a2, b2);
+
+		__m256i value1 = _mm256_add_epi16(_mm256_srli_epi16(sum1, 1), divide_by_4_epi16(d1));
+		__m256i value2 = _mm256_add_epi16(_mm256_srli_epi16(sum2, 1), divide_by_4_epi16(d2));
+		__m256i both = _mm256_add_epi16(_mm256_srli_epi16(_mm256_add_epi16(sum1, sum2), 2),
+			divide_by_8_epi16(_mm256_add_epi16(d1, d2)));
+
+		__m256i result = _mm256_blendv_epi8(both, value1, _mm256_cmpgt_epi16(gradient2, gradient1));
+		return _mm256_blendv_epi8(result, value2, _mm256_cmpgt_epi16(gradient1, gradient2));
+	}
+};
+
+struct avx2_samples16 {
+	static constexpr int64_t count = 8;
+
+	CPU_TARGET("avx2")
+	static __m256i load(const uint16_t* samples) {
+		return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples)));
+	}
+
+	CPU_TARGET("avx2")
+	static __m128i pack(__m256i values, __m128i max_value) {
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(values, values), 0xD8);
+		return _mm_min_epu16(_mm256_castsi256_si128(packed), max_value);
+	}
+
+	CPU_TARGET("avx2")
+	static __m128i broadcast(uint16_t value) {
+		return _mm_set1_epi16(static_cast<short>(value));
+	}
+
+	CPU_TARGET("avx2")
+	static __m128i green_sites(int64_t row) {
+		return _mm_set1_epi32(green_parity(row) ? static_cast<int>(0xFFFF0000) : 0x0000FFFF);
+	}
+
+	CPU_TARGET("avx2")
+	static __m256i second_difference(__m256i a, __m256i b, __m256i c) {
+		return _mm256_sub_epi32(_mm256_sub_epi32(_mm256_add_epi32(a, a), b), c);
+	}
+
+	CPU_TARGET("avx2")
+	static __m256i average(__m256i a, __m256i b) {
+		return _mm256_srli_epi32(_mm256_add_epi32(a, b), 1);
+	}
+
+	CPU_TARGET("avx2")
+	static __m256i directional(__m256i a1, __m256i b1, __m256i d1, __m256i a2, __m256i b2, __m256i d2) {
+
+		__m256i gradient1 = _mm256_add_epi32(_mm256_abs_epi32(_mm256_sub_epi32(a1, b1)), _mm256_abs_epi32(d1));
+		__m256i gradient2 = _mm256_add_epi32(_mm256_abs_epi32(_mm256_sub_epi32(a2, b2)), _mm256_abs_epi32(d2));
+
+		__m256i sum1 = _mm256_add_epi32(a1, b1);
+		__m256i sum2 = _mm256_add_epi32(a2, b2);
+
+		__m256i value1 = _mm256_add_epi32(_mm256_srli_epi32(sum1, 1), divide_by_4_epi32(d1));
+		__m256i value2 = _mm256_add_epi32(_mm256_srli_epi32(sum2, 1), divide_by_4_epi32(d2));
+		__m256i both = _mm256_add_epi32(_mm256_srli_epi32(_mm256_add_epi32(sum1, sum2), 2),
+			divide_by_8_epi32(_mm256_add_epi32(d1, d2)));
+
+		__m256i result = _mm256_blendv_epi8(both, value1, _mm256_cmpgt_epi32(gradient2, gradient1));
+		return _mm256_blendv_epi8(result, value2, _mm256_cmpgt_epi32(gradient1, gradient2));
+	}
+};
+
+template<typename T>
+using avx2_samples = std::conditional_t<sizeof(T) == 1, avx2_samples8, avx2_samples16>;
+
+template<typename T>
+CPU_TARGET("avx2")
+static __m128i load_block(const T* samples) {
+	return _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples));
+}
+
+template<typename T>
+CPU_TARGET("avx2")
+static void store_block(T* samples, __m128i block) {
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(samples), block);
+}
+
+template<typename T>
+CPU_TARGET("avx2")
+static int64_t interpolate_green_avx2(const T* const* mosaic, int64_t row, int64_t cols, T max_value, T* green) {
+
+	using samples = avx2_samples<T>;
+
+	const T* above2 = mosaic[0];
+	const T* above = mosaic[1];
+	const T* center = mosaic[2];
+	const T* below = mosaic[3];
+	const T* below2 = mosaic[4];
+
+	__m128i sites = samples::green_sites(row);
+	__m128i max_values = samples::broadcast(max_value);
+
+	int64_t col = 0;
+
+	// The loads reach 2 columns past the block, inside the border
+	for (; col + samples::count <= cols; col += samples::count) {
+		__m256i x5 = samples::load(center + col);
+
+		__m256i interpolated = samples::directional(
+			samples::load(center + col - 1), samples::load(center + col + 1),
+			samples::second_difference(x5, samples::load(center + col - 2), samples::load(center + col + 2)),
+			samples::load(above + col), samples::load(below + col),
+			samples::second_difference(x5, samples::load(above2 + col), samples::load(below2 + col)));
+
+		__m128i result = _mm_blendv_epi8(samples::pack(interpolated, max_values), load_block(center + col), sites);
+
+		store_block(green + col, result);
+	}
+
+	return col;
+}
+
+template<typename T>
+CPU_TARGET("avx2")
+static int64_t interpolate_red_blue_avx2(const T* const* mosaic, const T* const* greens, int64_t row,
+	int64_t cols, T max_value, T* red, T* blue) {
+
+	using samples = avx2_samples<T>;
+
+	const T* above = mosaic[1];
+	const T* center = mosaic[2];
+	const T* below = mosaic[3];
+
+	const T* green_above = greens[0];
+	const T* green = greens[1];
+	const T* green_below = greens[2];
+
+	__m128i sites = samples::green_sites(row);
+	__m128i max_values = samples::broadcast(max_value);
+	T* row_color = green_parity(row) ? red : blue;
+	T* other_color = green_parity(row) ? blue : red;
+
+	int64_t col = 0;
+
+	for (; col + samples::count <= cols; col += samples::count) {
+		__m256i g5 = samples::load(green + col);
+
+		__m256i diagonal = samples::directional(
+			samples::load(above + col - 1), samples::load(below + col + 1),
+			samples::second_difference(g5, samples::load(green_above + col - 1), samples::load(green_below + col + 1)),
+			samples::load(above + col + 1), samples::load(below + col - 1),
+			samples::second_difference(g5, samples::load(green_above + col + 1), samples::load(green_below + col - 1)));
+
+		__m256i horizontal = samples::average(samples::load(center + col - 1), samples::load(center + col + 1));
+		__m256i vertical = samples::average(samples::load(above + col), samples::load(below + col));
+
+		store_block(row_color + col, _mm_blendv_epi8(load_block(center + col), samples::pack(horizontal, max_values), sites));
+		store_block(other_color + col, _mm_blendv_epi8(samples::pack(diagonal, max_values), samples::pack(vertical, max_values), sites));
+	}
+
+	return col;
+}
+
+#endif
+
+template<typename T>
+static void interpolate_green(const T* const* mosaic, int64_t row, int64_t cols, T max_value, T* green) {
+
+	int64_t col = 0;
+
+#if defined(CPU_X86)
+	if (cpu_features::has_avx2()) {
+		col = interpolate_green_avx2(mosaic, row, cols, max_value, green);
+	}
+#endif
+
+	interpolate_green_scalar(mosaic, row, cols, col, max_value, green);
+}
+
+template<typename T>
+static void interpolate_red_blue(const T* const* mosaic, const T* const* greens, int64_t row,
+	int64_t cols, T max_value, T* red, T* blue) {
+
+	int64_t col = 0;
+
+#if defined(CPU_X86)
+	if (cpu_features::has_avx2()) {
+		col = interpolate_red_blue_avx2(mosaic, greens, row, cols, max_value, red, blue);
+	}
+#endif
+
+	interpolate_red_blue_scalar(mosaic, greens, row, cols, col, max_value, red, blue);
+}
+
+static void interleave_rgb(const uint8_t* red, const uint8_t* green, const uint8_t* blue, size_t count, uint8_t* rgb) {
+	planar::interleave_rgb(red, green, blue, count, rgb);
+}
+
+static void interleave_rgb(const uint16_t* red, const uint16_t* green, const uint16_t* blue, size_t count, uint16_t* rgb) {
+
+	for (size_t i = 0; i < count; ++i) {
+		rgb[i * 3] = red[i];
+		rgb[i * 3 + 1] = green[i];
+		rgb[i * 3 + 2] = blue[i];
+	}
+}
+
+template<typename T>
+demosaic_stream<T>::demosaic_stream(uint64_t rows, uint64_t cols, T max_value, uint64_t block_rows) : rows_(rows),
+	cols_(cols), stride_(cols + 2 * border), block_rows_(std::max(block_rows, halo)), max_value_(max_value),
+	mosaic_((block_rows_ + 2 * halo) * stride_), zero_row_(stride_), bands_((block_rows_ + band_rows - 1) / band_rows),
+	window_first_(-static_cast<int64_t>(halo)) {
+
+	for (auto& band : bands_) {
+		band.green.resize((band_rows + 2) * stride_);
+		band.red.resize(cols_);
+		band.blue.resize(cols_);
+	}
+}
+
+template<typename T>
+const T* demosaic_stream<T>::mosaic_row(int64_t row) const {
+
+	if (row < 0 || static_cast<uint64_t>(row) >= rows_) {
+		return zero_row_.data() + border;
+	}
+
+	return mosaic_.data() + (row - window_first_) * stride_ + border;
+}
+
+template<typename T>
+uint64_t demosaic_stream<T>::interpolate(uint64_t last, T* rgb) {
+
+	int64_t first = next_output_;
+	int64_t rows = rows_;
+	int64_t cols = cols_;
+
+	pool_.run((last - first + band_rows - 1) / band_rows, [&](size_t index) {
+
+		band_buffers& band = bands_[index];
+
+		int64_t first_row = first + index * band_rows;
+		int64_t last_row = std::min<int64_t>(first_row + band_rows, last);
+
+		auto green_row = [&](int64_t row) -> T* {
+			if (row < 0 || row >= rows) {
+				return zero_row_.data() + border;
+			}
+
+			return band.green.data() + (row - first_row + 1) * stride_ + border;
+		};
+
+		// The red and blue need the green of the rows above and below, so the band also interpolates the one
+		// before it and the one after it
+		for (int64_t row = std::max<int64_t>(first_row - 1, 0); row < std::min(last_row + 1, rows); ++row) {
+			const T* mosaic[] = { mosaic_row(row - 2), mosaic_row(row - 1), mosaic_row(row), mosaic_row(row + 1), mosaic_row(row + 2) };
+
+			interpolate_green(mosaic, row, cols, max_value_, green_row(row));
+		}
+
+		for (int64_t row = first_row; row < last_row; ++row) {
+			const T* mosaic[] = { nullptr, mosaic_row(row - 1), mosaic_row(row), mosaic_row(row + 1), nullptr };
+			const T* greens[] = { green_row(row - 1), green_row(row), green_row(row + 1) };
+
+			interpolate_red_blue(mosaic, greens, row, cols, max_value_, band.red.data(), band.blue.data());
+			interleave_rgb(band.red.data(), greens[1], band.blue.data(), cols_, rgb + (row - first) * cols_ * 3);
+		}
+	});
+
+	// The next rows to interpolate need the mosaic from 3 rows above them
+	int64_t keep_first = static_cast<int64_t>(last) - static_cast<int64_t>(halo);
+
+	std::memmove(mosaic_.data(), mosaic_.data() + (keep_first - window_first_) * stride_, (static_cast<int64_t>(next_row_) - keep_first) * stride_ * sizeof(T));
+
+	window_first_ = keep_first;
+	next_output_ = last;
+
+	return last - first;
+}
+
+template<typename T>
+uint64_t demosaic_stream<T>::push_rows(const T* samples, uint64_t count, T* rgb) {
+
+	count = std::min(count, rows_ - next_row_);
+
+	for (uint64_t i = 0; i < count; ++i, ++next_row_) {
+		std::memcpy(mosaic_.data() + (next_row_ - window_first_) * stride_ + border, samples + i * cols_, cols_ * sizeof(T));
+	}
+
+	// The last rows wait for flush(), so that each call stores at most block_rows()
+	if (next_row_ <= next_output_ + halo) {
+		return 0;
+	}
+
+	return interpolate(next_row_ - halo, rgb);
+}
+
+template<typename T>
+uint64_t demosaic_stream<T>::flush(T* rgb) {
+
+	if (next_output_ >= rows_) {
+		return 0;
+	}
+
+	return interpolate(rows_, rgb);
+}
+
+template class demosaic_stream<uint8_t>;
+template class demosaic_stream<uint16_t>;
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include "../../support/thread_pool/thread_pool.h"
+
+// Interpolates the RG/GB Bayer mosaic (red in the top left corner) to interleaved RGB pixels, choosing for each
+// missing sample the direction with the smallest gradient. The mosaic is given a block of rows at a time and the
+// interpolated rows come out in order as soon as the rows around them are known: the red and blue of a row need
+// the green of the rows above and below, which needs the mosaic 2 rows further, so the output is 3 rows behind.
+// The rows of each block are split in bands interpolated in parallel, and only a block of the mosaic with its
+// halo rows is kept. T is uint8_t or uint16_t, the interpolated samples are clamped to max_value.
+template<typename T>
+class demosaic_stream {
+private:
+	static constexpr uint64_t border = 2;
+	static constexpr uint64_t halo = 3;
+	static constexpr uint64_t band_rows = 32;
+
+	// Green of the rows of a band and of the one before and after it, red and blue of a row
+	struct band_buffers {
+		std::vector<T> green;
+		std::vector<T> red;
+		std::vector<T> blue;
+	};
+
+	uint64_t rows_ = 0;
+	uint64_t cols_ = 0;
+	uint64_t stride_ = 0;
+	uint64_t block_rows_ = 0;
+	T max_value_ = 0;
+
+	// Rows with a border of zeros on both sides, so that the interpolation reads the missing neighbours of the
+	// edge pixels as 0 without any check. The rows outside the image are the zero row.
+	std::vector<T> mosaic_;
+	std::vector<T> zero_row_;
+	std::vector<band_buffers> bands_;
+	thread_pool pool_;
+
+	// The mosaic rows kept start from window_first_, 3 before the next row to interpolate
+	int64_t window_first_ = 0;
+	uint64_t next_row_ = 0;
+	uint64_t next_output_ = 0;
+
+	const T* mosaic_row(int64_t row) const;
+
+	// Interpolates the rows from next_output_ to last in parallel, then drops the mosaic rows not needed anymore
+	uint64_t interpolate(uint64_t last, T* rgb);
+
+public:
+	demosaic_stream(uint64_t rows, uint64_t cols, T max_value = std::numeric_limits<T>::max(), uint64_t block_rows = 256);
+
+	// Most rows given to push_rows() at a time, and most rows it and flush() store
+	uint64_t block_rows() const {
+		return block_rows_;
+	}
+
+	// Adds the next count rows of the mosaic (at most block_rows()), cols samples each. Stores in rgb the rows
+	// this completes, cols pixels each, and returns their number.
+	uint64_t push_rows(const T* samples, uint64_t count, T* rgb);
+
+	// After all the rows are given, stores the rows still missing as push_rows() does
+	uint64_t flush(T* rgb);
+};
+
+extern template class demosaic_stream<uint8_t>;
+extern template class demosaic_stream<uint16_t>;
@@ -2,172 +2,19 @@
 #include <cstdint>
 #include <string>
 #include <array>
-#include <optional>
 #include <iostream>
 #include <vector>
+#include <memory>
+#include <limits>
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
 
-template<typename T>
-T raw_read(std::istream& input, size_t size = sizeof(T)) {
-	T value = 0;
-	input.read(reinterpret_cast<char*>(&value), size);
-	return value;
-}
-
-template<typename T>
-void raw_write(std::ostream& output, T value, size_t size = sizeof(T)) {
-	output.write(reinterpret_cast<char*>(&value), size);
-}
+#include "../../support/netpbm/netpbm.h"
+#include "demosaic.h"
 
 using vec3b = std::array<uint8_t, 3>;
 
-template<typename T>
-class matrix {
-private:
-	uint64_t rows_ = 0;
-	uint64_t cols_ = 0;
-	std::vector <T> data_;
-
-public:
-	matrix() {}
-
-	matrix(uint64_t rows, uint64_t cols) {
-		resize(rows, cols);
-	}
-
-	void resize(uint64_t rows, uint64_t cols) {
-		rows_ = rows;
-		cols_ = cols;
-		data_.resize(rows_ * cols_);
-	}
-
-	T& operator () (uint64_t row, uint64_t col) {
-		return data_[row * cols_ + col];
-	}
-
-	const T& operator () (uint64_t row, uint64_t col) const {
-		return data_[row * cols_ + col];
-	}
-
-	// Get with bounduary checks
-	T safe_get(int64_t row, int64_t col) const {
-		if (row < 0 || col < 0) {
-			return T();
-		}
-
-		if (static_cast<uint64_t>(row) > (rows_ - 1) || static_cast<uint64_t>(col) > (cols_ - 1)) {
-			return T();
-		}
-
-		return data_[row * cols_ + col];
-	}
-
-	uint64_t rows() const {
-		return rows_;
-	}
-
-	uint64_t cols() const {
-		return cols_;
-	}
-
-};
-
-static std::optional<matrix<uint8_t>> load_bayer_pgm(std::string filename) {
-
-	std::ifstream input(filename, std::ios::binary);
-
-	if (!input) {
-		return std::nullopt;
-	}
-
-	std::string magic_number;
-	input >> magic_number >> std::ws;
-
-	if (input.peek() == '#') {
-		std::string comment;
-		std::getline(input, comment);
-	}
-
-	std::string width_str;
-	input >> width_str >> std::ws;
-	uint64_t width = std::stoi(width_str);
-
-	std::string height_str;
-	input >> height_str >> std::ws;
-	uint64_t height = std::stoi(height_str);
-
-	std::string max_value_str;
-	input >> max_value_str >> std::ws;
-	uint64_t max_value = std::stoi(max_value_str);
-
-	matrix<uint8_t> raster(height, width);
-
-	for (uint64_t row = 0; row < raster.rows(); ++row) {
-		for (uint64_t col = 0; col < raster.cols(); ++col) {
-
-			uint16_t byte1 = raw_read<uint8_t>(input);
-
-			if (max_value < 256) {
-				raster(row, col) = static_cast<uint8_t>(byte1);
-			}
-			else {
-				uint16_t byte2 = raw_read<uint8_t>(input);
-				uint16_t pixel = (byte1 << 8) | byte2;
-				uint8_t scaled_pixel = static_cast<uint8_t>(pixel / 256);
-				raster(row, col) = scaled_pixel;
-			}
-		}
-	}
-
-	return raster;
-}
-
-static bool write_pgm(std::string filename, const matrix<uint8_t>& raster) {
-
-	std::ofstream output(filename, std::ios::binary);
-
-	if (!output) {
-		return false;
-	}
-
-	output << "P5" << std::endl;
-	output << raster.cols() << " " << raster.rows() << std::endl;
-	output << 255 << std::endl;
-
-	for (uint64_t row = 0; row < raster.rows(); ++row) {
-		for (uint64_t col = 0; col < raster.cols(); ++col) {
-			uint8_t pixel = raster(row, col);
-			raw_write<uint8_t>(output, pixel);
-		}
-	}
-
-	return true;
-}
-
-static bool write_ppm(std::string filename, const matrix<vec3b>& raster) {
-
-	std::ofstream output(filename, std::ios::binary);
-
-	if (!output) {
-		return false;
-	}
-
-	output << "P6" << std::endl;
-	output << raster.cols() << " " << raster.rows() << std::endl;
-	output << 255 << std::endl;
-
-	for (uint64_t row = 0; row < raster.rows(); ++row) {
-		for (uint64_t col = 0; col < raster.cols(); ++col) {
-			vec3b pixel = raster(row, col);
-			raw_write<uint8_t>(output, pixel[0]);
-			raw_write<uint8_t>(output, pixel[1]);
-			raw_write<uint8_t>(output, pixel[2]);
-		}
-	}
-
-	return true;
-}
-
 enum class bayer_color {
 	red,
 	green,
@@ -193,225 +40,188 @@ static bayer_color get_bayer_color(uint64_t row, uint64_t col) {
 	}
 }
 
-static matrix<vec3b> split_bayer_components(const matrix<uint8_t>& raster) {
-
-	matrix<vec3b> bayer(raster.rows(), raster.cols());
-
-	for (uint64_t row = 0; row < raster.rows(); ++row) {
-		for (uint64_t col = 0; col < raster.cols(); ++col) {
+// 8 bit value of each sample for the previews: the sample over max_value raised to 1 / gamma. The demosaicing
+// works on the samples as they are, they go through this only when written.
+template<typename T>
+static std::vector<uint8_t> create_tone_curve(uint32_t max_value, double gamma) {
 
-			bayer_color color = get_bayer_color(row, col);
+	std::vector<uint8_t> tone_curve(static_cast<size_t>(std::numeric_limits<T>::max()) + 1);
 
-			if (color == bayer_color::red) {
-				bayer(row, col)[0] = raster(row, col);
-			}
-			else if (color == bayer_color::green) {
-				bayer(row, col)[1] = raster(row, col);
-			}
-			else if (color == bayer_color::blue) {
-				bayer(row, col)[2] = raster(row, col);
-			}
-		}
+	for (size_t value = 0; value < tone_curve.size(); ++value) {
+		double level = static_cast<double>(std::min<size_t>(value, max_value)) / max_value;
+		tone_curve[value] = static_cast<uint8_t>(std::lround(255 * std::pow(level, 1 / gamma)));
 	}
 
-	return bayer;
+	return tone_curve;
 }
 
-static uint8_t saturate_value(int32_t value) {
-	if (value > 255) {
-		return 255;
-	}
-	else if (value < 0) {
-		return 0;
-	}
-	else {
-		return static_cast<uint8_t>(value);
+template<typename T>
+static void apply_tone_curve(const T* samples, size_t count, const std::vector<uint8_t>& tone_curve, uint8_t* output) {
+	for (size_t i = 0; i < count; ++i) {
+		output[i] = tone_curve[samples[i]];
 	}
 }
 
-static void reconstruct_green(matrix<vec3b>& raster) {
-
-	for (uint64_t row = 0; row < raster.rows(); ++row) {
-		for (uint64_t col = 0; col < raster.cols(); ++col) {
+static void split_bayer_components(const uint8_t* samples, uint64_t row, uint64_t cols, vec3b* bayer) {
 
-			/*vec3b pixel = raster(row, col);
+	for (uint64_t col = 0; col < cols; ++col) {
 
-			if (pixel[0] == 0 && pixel[1] == 0 && pixel[2] == 0) {
-				continue;
-			}*/
+		bayer_color color = get_bayer_color(row, col);
 
-			bayer_color pixel_color = get_bayer_color(row, col);
+		bayer[col] = {};
 
-			if (pixel_color == bayer_color::green) {
-				continue;
-			}
-
-			uint8_t index = pixel_color == bayer_color::red ? 0 : 2;
-
-			int32_t x5 = raster.safe_get(row, col)[index];
-
-			int32_t g4 = raster.safe_get(row, col - 1)[1];
-			int32_t x3 = raster.safe_get(row, col - 2)[index];
-
-			int32_t g6 = raster.safe_get(row, col + 1)[1];
-			int32_t x7 = raster.safe_get(row, col + 2)[index];
-
-			int32_t g2 = raster.safe_get(row - 1, col)[1];
-			int32_t x1 = raster.safe_get(row - 2, col)[index];
+		if (color == bayer_color::red) {
+			bayer[col][0] = samples[col];
+		}
+		else if (color == bayer_color::green) {
+			bayer[col][1] = samples[col];
+		}
+		else if (color == bayer_color::blue) {
+			bayer[col][2] = samples[col];
+		}
+	}
+}
 
-			int32_t g8 = raster.safe_get(row + 1, col)[1];
-			int32_t x9 = raster.safe_get(row + 2, col)[index];
+// The mosaic samples with the interpolated green. The red and blue of the interpolated row are the samples of
+// the mosaic where it has them.
+static void add_green_components(const vec3b* interpolated, uint64_t row, uint64_t cols, vec3b* green) {
 
-			int32_t dh_x = x5 - x3 + x5 - x7;
-			int32_t dv_x = x5 - x1 + x5 - x9;
-			int32_t dh = std::abs(g4 - g6) + std::abs(dh_x);
-			int32_t dv = std::abs(g2 - g8) + std::abs(dv_x);
+	for (uint64_t col = 0; col < cols; ++col) {
 
-			int32_t green_component;
+		bayer_color color = get_bayer_color(row, col);
 
-			if (dh < dv) {
-				green_component = (g4 + g6) / 2 + (dh_x) / 4;
-			}
-			else if (dh > dv) {
-				green_component = (g2 + g8) / 2 + (dv_x) / 4;
-			}
-			else {
-				green_component = (g2 + g4 + g6 + g8) / 4 + (dh_x + dv_x) / 8;
-			}
+		green[col] = { 0, interpolated[col][1], 0 };
 
-			raster(row, col)[1] = saturate_value(green_component);
+		if (color == bayer_color::red) {
+			green[col][0] = interpolated[col][0];
+		}
+		else if (color == bayer_color::blue) {
+			green[col][2] = interpolated[col][2];
 		}
 	}
 }
 
-static void reconstruct_red_blue(matrix<vec3b>& raster) {
+static bool finish_output(netpbm::row_writer& output, const std::string& file_name) {
 
-	for (uint64_t row = 0; row < raster.rows(); ++row) {
-		for (uint64_t col = 0; col < raster.cols(); ++col) {
+	if (!output.finish()) {
+		std::cerr << "Failed to write " << file_name << std::endl;
+		return false;
+	}
 
-			/*vec3b pixel = raster(row, col);
+	return true;
+}
 
-			if (pixel[0] == 0 && pixel[1] == 0 && pixel[2] == 0) {
-				continue;
-			}*/
+// Demosaics an image with samples of type T. Every step is written as an 8 bit preview and, for 16 bit samples,
+// the interpolated image also at full precision. Every output is written a block of rows at a time while the mosaic
+// is read, the rows of each block are demosaiced in parallel.
+template<typename T>
+static bool decode_bayer(netpbm::row_reader& input, const std::string& prefix, double gamma) {
 
-			bayer_color pixel_color = get_bayer_color(row, col);
+	uint32_t width = input.info().width;
+	uint32_t height = input.info().height;
+	uint32_t max_value = input.info().max_value;
 
-			if (pixel_color == bayer_color::green) {
+	std::vector<uint8_t> tone_curve = create_tone_curve<T>(max_value, gamma);
 
-				bayer_color right_side_pixel_color = get_bayer_color(row, col + 1);
+	std::string gray_file_name = prefix + "_gray.pgm";
+	std::string bayer_file_name = prefix + "_bayer.ppm";
+	std::string green_file_name = prefix + "_green.ppm";
+	std::string interpolated_file_name = prefix + "_interp.ppm";
+	std::string full_file_name = prefix + "_interp16.ppm";
 
-				vec3b pixel2 = raster.safe_get(row - 1, col);
-				vec3b pixel4 = raster.safe_get(row, col - 1);
-				vec3b pixel6 = raster.safe_get(row, col + 1);
-				vec3b pixel8 = raster.safe_get(row + 1, col);
+	netpbm::row_writer gray_output(gray_file_name, netpbm::pgm_header(width, height));
+	netpbm::row_writer bayer_output(bayer_file_name, netpbm::ppm_header(width, height));
+	netpbm::row_writer green_output(green_file_name, netpbm::ppm_header(width, height));
+	netpbm::row_writer interpolated_output(interpolated_file_name, netpbm::ppm_header(width, height));
+	std::unique_ptr<netpbm::row_writer> full_output;
 
-				uint8_t index1 = right_side_pixel_color == bayer_color::red ? 0 : 2;
-				uint8_t index2 = right_side_pixel_color == bayer_color::red ? 2 : 0;
+	if (sizeof(T) == 2) {
+		full_output = std::make_unique<netpbm::row_writer>(full_file_name, netpbm::ppm_header(width, height, max_value));
+	}
 
-				int32_t x2 = pixel2[index2];
-				int32_t x4 = pixel4[index1];
-				int32_t x6 = pixel6[index1];
-				int32_t x8 = pixel8[index2];
+	demosaic_stream<T> demosaic(height, width, static_cast<T>(max_value));
 
-				int32_t avg_h = (x4 + x6) / 2;
-				int32_t avg_v = (x2 + x8) / 2;
+	size_t block_rows = demosaic.block_rows();
+	size_t block_pixels = block_rows * width;
 
-				raster(row, col)[index1] = saturate_value(avg_h);
-				raster(row, col)[index2] = saturate_value(avg_v);
-			}
-			else {
+	std::vector<T> samples;
+	std::vector<uint8_t> gray(block_pixels);
+	std::vector<vec3b> bayer(block_pixels);
+	std::vector<vec3b> green(block_pixels);
+	std::vector<vec3b> preview(block_pixels);
+	std::vector<std::array<T, 3>> interpolated(block_pixels);
+	uint64_t interpolated_row = 0;
 
-				uint8_t index = pixel_color == bayer_color::red ? 2 : 0;
+	auto write_interpolated = [&](uint64_t rows) {
+		apply_tone_curve(interpolated.front().data(), rows * width * 3, tone_curve, preview.front().data());
 
-				int32_t g5 = raster.safe_get(row, col)[1];
+		for (uint64_t i = 0; i < rows; ++i) {
+			add_green_components(preview.data() + i * width, interpolated_row++, width, green.data() + i * width);
+		}
 
-				vec3b pixel1 = raster.safe_get(row - 1, col - 1);
-				int32_t x1 = pixel1[index];
-				int32_t g1 = pixel1[1];
+		green_output.write_rows(green.data(), static_cast<uint32_t>(rows));
+		interpolated_output.write_rows(preview.data(), static_cast<uint32_t>(rows));
 
-				vec3b pixel3 = raster.safe_get(row - 1, col + 1);
-				int32_t x3 = pixel3[index];
-				int32_t g3 = pixel3[1];
+		if (full_output) {
+			full_output->write_rows(interpolated.data(), static_cast<uint32_t>(rows));
+		}
+	};
 
-				vec3b pixel7 = raster.safe_get(row + 1, col - 1);
-				int32_t x7 = pixel7[index];
-				int32_t g7 = pixel7[1];
+	for (uint32_t row = 0; row < height;) {
 
-				vec3b pixel9 = raster.safe_get(row + 1, col + 1);
-				int32_t x9 = pixel9[index];
-				int32_t g9 = pixel9[1];
+		uint32_t rows = input.read_rows(samples, static_cast<uint32_t>(block_rows));
 
-				int32_t dn_x = g5 - g1 + g5 - g9;
-				int32_t dp_x = g5 - g3 + g5 - g7;
+		if (rows == 0) {
+			std::cerr << "Failed to load the pgm file" << std::endl;
+			return false;
+		}
 
-				int32_t dn = std::abs(x1 - x9) + std::abs(dn_x);
-				int32_t dp = std::abs(x3 - x7) + std::abs(dp_x);
+		apply_tone_curve(samples.data(), static_cast<size_t>(rows) * width, tone_curve, gray.data());
+		gray_output.write_rows(gray.data(), rows);
 
-				int32_t x_component;
+		for (uint32_t i = 0; i < rows; ++i) {
+			split_bayer_components(gray.data() + static_cast<size_t>(i) * width, row + i, width, bayer.data() + static_cast<size_t>(i) * width);
+		}
 
-				if (dn < dp) {
-					x_component = (x1 + x9) / 2 + (dn_x) / 4;
-				}
-				else if (dn > dp) {
-					x_component = (x3 + x7) / 2 + (dp_x) / 4;
-				}
-				else {
-					x_component = (x1 + x3 + x7 + x9) / 4 + (dn_x + dp_x) / 8;
-				}
+		bayer_output.write_rows(bayer.data(), rows);
 
-				raster(row, col)[index] = saturate_value(x_component);
-			}
-		}
+		write_interpolated(demosaic.push_rows(samples.data(), rows, interpolated.front().data()));
+		row += rows;
 	}
+
+	write_interpolated(demosaic.flush(interpolated.front().data()));
+
+	return finish_output(gray_output, gray_file_name) && finish_output(bayer_output, bayer_file_name) &&
+		finish_output(green_output, green_file_name) && finish_output(interpolated_output, interpolated_file_name) &&
+		(!full_output || finish_output(*full_output, full_file_name));
 }
 
 int main(int argc, char* argv[]) {
 
-	if (argc != 3) {
+	if (argc != 3 && argc != 4) {
 		std::cerr << "Wrong number of arguments" << std::endl;
 		return EXIT_FAILURE;
 	}
 
 	std::string prefix(argv[2]);
 
-	std::optional<matrix<uint8_t>> grey_pgm = load_bayer_pgm(argv[1]);
+	// Gamma of the 8 bit previews
+	double gamma = argc == 4 ? std::atof(argv[3]) : 1.0;
 
-	if (!grey_pgm.has_value()) {
-		std::cerr << "Failed to load the pgm file" << std::endl;
+	if (!(gamma > 0)) {
+		std::cerr << "The gamma must be a positive number" << std::endl;
 		return EXIT_FAILURE;
 	}
 
-	std::string gray_file_name = prefix + "_gray.pgm";
+	netpbm::row_reader input(argv[1]);
 
-	if (!write_pgm(gray_file_name, grey_pgm.value())) {
-		std::cerr << "Failed to write " << gray_file_name << std::endl;
-		return EXIT_FAILURE;
-	}
-
-	std::string bayer_file_name = prefix + "_bayer.ppm";
-	matrix<vec3b> bayer_image = split_bayer_components(grey_pgm.value());
-
-	if (!write_ppm(bayer_file_name, bayer_image)) {
-		std::cerr << "Failed to write " << bayer_file_name << std::endl;
-		return EXIT_FAILURE;
-	}
-
-	std::string green_file_name = prefix + "_green.ppm";
-	reconstruct_green(bayer_image);
-
-	if (!write_ppm(green_file_name, bayer_image)) {
-		std::cerr << "Failed to write " << green_file_name << std::endl;
+	if (!input.good() || input.info().format != netpbm::format::pgm) {
+		std::cerr << "Failed to load the pgm file" << std::endl;
 		return EXIT_FAILURE;
 	}
 
-	std::string interpolated_file_name = prefix + "_interp.ppm";
-	reconstruct_red_blue(bayer_image);
+	bool decoded = input.info().sample_size() == 1 ? decode_bayer<uint8_t>(input, prefix, gamma) :
+		decode_bayer<uint16_t>(input, prefix, gamma);
 
-	if (!write_ppm(interpolated_file_name, bayer_image)) {
-		std::cerr << "Failed to write " << interpolated_file_name << std::endl;
-		return EXIT_FAILURE;
-	}
-
-	return EXIT_SUCCESS;
-}
\ No newline at end of file
+	return decoded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -7,18 +7,17 @@
 #include <unordered_map>
 #include <algorithm>
 #include <limits>
+#include <cstring>
+#include <bit>
+#include <atomic>
 
-template<typename T>
-T raw_read(std::istream& input, size_t size = sizeof(T)) {
-	T buffer = 0;
-	input.read(reinterpret_cast<char*>(&buffer), size);
-	return buffer;
-}
+#include "../../support/netpbm/netpbm.h"
+#include "../../support/thread_pool/thread_pool.h"
 
-template<typename T>
-void raw_write(std::ostream& output, T value) {
-	output.write(reinterpret_cast<char*>(&value), sizeof(value));
-}
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HDR_SSE2
+#include <emmintrin.h>
+#endif
 
 using vec3b = std::array<uint8_t, 3>;
 using vec3f = std::array<float, 3>;
@@ -59,6 +58,10 @@ public:
 		return cols_;
 	}
 
+	const T* data() const {
+		return data_.data();
+	}
+
 	const auto begin() const {
 		return data_.begin();
 	}
@@ -68,21 +71,394 @@ public:
 	}
 };
 
+// floor(x^gamma * 255) for x in [0, 1] without a pow for every value. A table indexed by the exponent and the top
+// 7 bits of the mantissa of x gives the result at the start of each bucket, one step below the exact one at most
+// for gammas under 1, and the smallest x of each result corrects it, so the results are exactly those of std::pow.
+// Values above 1 give 255.
+class gamma_table {
+private:
+	static constexpr int mantissa_shift = 16;
+
+	// The smallest x of each result, found bisecting the bit patterns of the positive floats, which are in the
+	// same order as the floats
+	std::array<float, 256> thresholds_{};
+	std::vector<uint8_t> values_;
+	uint32_t first_bucket_ = 0;
+
+	static uint8_t compute(float x, float gamma) {
+		return static_cast<uint8_t>(std::pow(x, gamma) * 255);
+	}
+
+public:
+	explicit gamma_table(float gamma) {
+
+		for (int value = 1; value < 256; ++value) {
+			uint32_t low = 0;
+			uint32_t high = std::bit_cast<uint32_t>(1.0f);
+
+			while (low < high) {
+				uint32_t middle = low + (high - low) / 2;
+
+				if (compute(std::bit_cast<float>(middle), gamma) >= value) {
+					high = middle;
+				}
+				else {
+					low = middle + 1;
+				}
+			}
+
+			thresholds_[value] = std::bit_cast<float>(low);
+		}
+
+		// Everything below the first threshold is 0, the buckets start there
+		first_bucket_ = std::bit_cast<uint32_t>(thresholds_[1]) >> mantissa_shift;
+		values_.resize((std::bit_cast<uint32_t>(1.0f) >> mantissa_shift) - first_bucket_);
+
+		for (uint32_t i = 0; i < values_.size(); ++i) {
+			values_[i] = compute(std::bit_cast<float>((first_bucket_ + i) << mantissa_shift), gamma);
+		}
+	}
+
+	uint8_t operator()(float x) const {
+
+		if (!(x > 0)) {
+			return 0;
+		}
+
+		// Also infinity, the search below stops at 254
+		if (x >= thresholds_[255]) {
+			return 255;
+		}
+
+		// Values below the first bucket start from its 0 and those from 1 up from the last bucket, which is under 255
+		uint32_t bucket = std::clamp(std::bit_cast<uint32_t>(x) >> mantissa_shift, first_bucket_,
+			first_bucket_ + static_cast<uint32_t>(values_.size()) - 1);
+
+		int value = values_[bucket - first_bucket_];
+		value += x >= thresholds_[value + 1];
+
+		while (x >= thresholds_[value + 1]) {
+			++value;
+		}
+
+		return static_cast<uint8_t>(value);
+	}
+};
+
 class hdr {
 private:
 	matrix<vec3f> raster_;
+	bool good_ = false;
+
+	// Rows given to each task of the thread pool
+	static constexpr uint64_t block_rows = 16;
+
+	// The workers are started once and shared by every pass over the image
+	static thread_pool& pool() {
+		static thread_pool workers;
+		return workers;
+	}
+
+	// Runs task(first_row, last_row) in parallel for blocks of rows covering [0, rows)
+	template<typename Task>
+	static void for_each_block(uint64_t rows, Task task) {
+
+		pool().run((rows + block_rows - 1) / block_rows, [&](size_t block) {
+			uint64_t first_row = block * block_rows;
+			task(first_row, std::min(first_row + block_rows, rows));
+		});
+	}
+
+	static const gamma_table& display_gamma() {
+		static const gamma_table table(0.45f);
+		return table;
+	}
+
+	// 2^(e - 128) for every exponent, all exact in a float
+	static const std::array<float, 256>& exponent_scales() {
+
+		static const std::array<float, 256> scales = [] {
+			std::array<float, 256> table{};
+
+			for (int e = 0; e < 256; ++e) {
+				table[e] = std::ldexp(1.0f, e - 128);
+			}
+
+			return table;
+		}();
+
+		return scales;
+	}
+
+	// Finds where each scanline starts, walking the run length commands without expanding them.
+	// Every scanline is 2, 2, the width in two bytes and then the 4 * width bytes of the R, G, B and E planes in
+	// runs (128 + count, byte) and literals (count, bytes).
+	static bool find_scanlines(const uint8_t* data, size_t size, uint64_t rows, uint64_t cols, std::vector<size_t>& offsets) {
+
+		offsets.resize(rows + 1);
+
+		size_t position = 0;
 
-	float reconstruct_value(uint8_t color, uint8_t e) {
-		float multiplier = std::pow(2, e - 128);
-		float result = (color + 0.5f) / 256 * multiplier;
-		return static_cast<float>(result);
+		for (uint64_t row = 0; row < rows; ++row) {
+
+			if (size - position < 4 || data[position] != 2 || data[position + 1] != 2 ||
+				static_cast<uint64_t>(data[position + 2] << 8 | data[position + 3]) != cols) {
+				return false;
+			}
+
+			offsets[row] = position;
+			position += 4;
+
+			for (uint64_t decoded = 0; decoded < cols * 4;) {
+
+				if (position == size) {
+					return false;
+				}
+
+				uint8_t command = data[position++];
+				size_t count = command > 127 ? command - 128 : command;
+				size_t skipped = command > 127 ? 1 : count;
+
+				// Commands of 0 bytes are not valid
+				if (count == 0 || size - position < skipped || cols * 4 - decoded < count) {
+					return false;
+				}
+
+				position += skipped;
+				decoded += count;
+			}
+		}
+
+		offsets[rows] = position;
+		return true;
+	}
+
+	// Expands a scanline found by find_scanlines() into its 4 planes. The commands were already checked, but a
+	// command that does not fit the planes is still refused: false is returned and nothing is written past them.
+	static bool decode_scanline(const uint8_t* data, uint64_t cols, uint8_t* planes) {
+
+		data += 4;
+
+		for (uint64_t decoded = 0; decoded < cols * 4;) {
+			uint8_t command = *data++;
+			uint64_t count = command > 127 ? command - 128 : command;
+
+			if (count == 0 || decoded + count > cols * 4) {
+				return false;
+			}
+
+			if (command <= 127) {
+				std::memcpy(planes + decoded, data, count);
+				data += count;
+			}
+			else {
+				std::memset(planes + decoded, *data++, count);
+			}
+
+			decoded += count;
+		}
+
+		return true;
+	}
+
+	// Each color is (mantissa + 0.5) / 256 * 2^(e - 128)
+	static void convert_scanline(const uint8_t* planes, uint64_t cols, vec3f* pixels) {
+
+		const auto& scales = exponent_scales();
+
+		const uint8_t* red = planes;
+		const uint8_t* green = planes + cols;
+		const uint8_t* blue = planes + cols * 2;
+		const uint8_t* exponent = planes + cols * 3;
+
+		uint64_t col = 0;
+
+#if defined(HDR_SSE2)
+		// 4 pixels at a time, interleaved in 3 vectors: r0 g0 b0 r1, g1 b1 r2 g2, b2 r3 g3 b3
+		static_assert(sizeof(vec3f) == 3 * sizeof(float), "pixels must be packed");
+
+		auto output = reinterpret_cast<float*>(pixels);
+
+		for (; col + 4 <= cols; col += 4) {
+			__m128 scale = _mm_setr_ps(scales[exponent[col]], scales[exponent[col + 1]],
+				scales[exponent[col + 2]], scales[exponent[col + 3]]);
+
+			__m128 r = convert_mantissas(red + col, scale);
+			__m128 g = convert_mantissas(green + col, scale);
+			__m128 b = convert_mantissas(blue + col, scale);
+
+			__m128 rg_low = _mm_unpacklo_ps(r, g);
+			__m128 rg_high = _mm_unpackhi_ps(r, g);
+			__m128 rb_low = _mm_unpacklo_ps(r, b);
+			__m128 rb_high = _mm_unpackhi_ps(r, b);
+			__m128 gb_low = _mm_unpacklo_ps(g, b);
+			__m128 gb_high = _mm_unpackhi_ps(g, b);
+
+			_mm_storeu_ps(output + col * 3, _mm_shuffle_ps(rg_low, rb_low, _MM_SHUFFLE(2, 1, 1, 0)));
+			_mm_storeu_ps(output + col * 3 + 4, _mm_shuffle_ps(gb_low, rg_high, _MM_SHUFFLE(1, 0, 3, 2)));
+			_mm_storeu_ps(output + col * 3 + 8, _mm_shuffle_ps(rb_high, gb_high, _MM_SHUFFLE(3, 2, 2, 1)));
+		}
+#endif
+
+		for (; col < cols; ++col) {
+			float scale = scales[exponent[col]];
+
+			pixels[col] = {
+				(red[col] + 0.5f) / 256 * scale,
+				(green[col] + 0.5f) / 256 * scale,
+				(blue[col] + 0.5f) / 256 * scale
+			};
+		}
 	}
 
-	uint8_t map_tone(float value, float min, float delta) {
-		float converted_value = (value - min) / delta;
-		float gamma_corrected = std::pow(converted_value, 0.45f);
-		uint8_t result = static_cast<uint8_t>(gamma_corrected * 255);
-		return result;
+#if defined(HDR_SSE2)
+	static __m128 convert_mantissas(const uint8_t* mantissas, __m128 scale) {
+
+		int32_t bytes;
+		std::memcpy(&bytes, mantissas, sizeof(bytes));
+
+		__m128i zero = _mm_setzero_si128();
+		__m128i values = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+
+		__m128 result = _mm_add_ps(_mm_cvtepi32_ps(values), _mm_set1_ps(0.5f));
+		return _mm_mul_ps(_mm_mul_ps(result, _mm_set1_ps(1.0f / 256)), scale);
+	}
+#endif
+
+	// Smallest and largest of count values
+	static void find_range(const float* values, size_t count, float& min_value, float& max_value) {
+
+		size_t i = 0;
+
+#if defined(HDR_SSE2)
+		__m128 low = _mm_set1_ps(min_value);
+		__m128 high = _mm_set1_ps(max_value);
+
+		for (; i + 4 <= count; i += 4) {
+			__m128 items = _mm_loadu_ps(values + i);
+			low = _mm_min_ps(low, items);
+			high = _mm_max_ps(high, items);
+		}
+
+		alignas(16) float lows[4];
+		alignas(16) float highs[4];
+		_mm_store_ps(lows, low);
+		_mm_store_ps(highs, high);
+
+		min_value = std::min({ lows[0], lows[1], lows[2], lows[3] });
+		max_value = std::max({ highs[0], highs[1], highs[2], highs[3] });
+#endif
+
+		for (; i < count; ++i) {
+			min_value = std::min(min_value, values[i]);
+			max_value = std::max(max_value, values[i]);
+		}
+	}
+
+	static float luminance(const vec3f& color) {
+		return 0.2126f * color[0] + 0.7152f * color[1] + 0.0722f * color[2];
+	}
+
+	// The log average and the largest of the luminances, the statistics of the Reinhard operators
+	void luminance_statistics(float& log_average, float& max_luminance) {
+
+		static constexpr double epsilon = 1e-4;
+
+		std::vector<double> log_sums((raster_.rows() + block_rows - 1) / block_rows);
+		std::vector<float> maxima(log_sums.size());
+
+		for_each_block(raster_.rows(), [&](uint64_t first_row, uint64_t last_row) {
+			double log_sum = 0;
+			float max_value = 0;
+
+			for (uint64_t row = first_row; row < last_row; ++row) {
+				for (uint64_t col = 0; col < raster_.cols(); ++col) {
+					float value = luminance(raster_(row, col));
+					log_sum += std::log(epsilon + value);
+					max_value = std::max(max_value, value);
+				}
+			}
+
+			log_sums[first_row / block_rows] = log_sum;
+			maxima[first_row / block_rows] = max_value;
+		});
+
+		double log_sum = 0;
+
+		for (double sum : log_sums) {
+			log_sum += sum;
+		}
+
+		size_t pixels = std::max<size_t>(raster_.rows() * raster_.cols(), 1);
+		log_average = static_cast<float>(std::exp(log_sum / pixels));
+		max_luminance = maxima.empty() ? 0 : *std::max_element(maxima.begin(), maxima.end());
+	}
+
+	// Scales every color by display_luminance(row, col, luminance) / luminance and applies the gamma
+	template<typename Operator>
+	matrix<vec3b> map_luminance(Operator display_luminance) {
+
+		const auto& gamma = display_gamma();
+
+		matrix<vec3b> data(raster_.rows(), raster_.cols());
+
+		for_each_block(data.rows(), [&](uint64_t first_row, uint64_t last_row) {
+			for (uint64_t row = first_row; row < last_row; ++row) {
+				for (uint64_t col = 0; col < data.cols(); ++col) {
+					const auto& value = raster_(row, col);
+
+					float world_luminance = luminance(value);
+					float ratio = world_luminance > 0 ? display_luminance(row, col, world_luminance) / world_luminance : 0;
+
+					data(row, col) = { gamma(value[0] * ratio), gamma(value[1] * ratio), gamma(value[2] * ratio) };
+				}
+			}
+		});
+
+		return data;
+	}
+
+	// Halves a luminance image, averaging blocks of 2x2 (the last row and column are repeated for odd sizes)
+	static matrix<float> downsample(const matrix<float>& image) {
+
+		matrix<float> half((image.rows() + 1) / 2, (image.cols() + 1) / 2);
+
+		for_each_block(half.rows(), [&](uint64_t first_row, uint64_t last_row) {
+			for (uint64_t row = first_row; row < last_row; ++row) {
+				uint64_t top = row * 2;
+				uint64_t bottom = std::min(top + 1, image.rows() - 1);
+
+				for (uint64_t col = 0; col < half.cols(); ++col) {
+					uint64_t left = col * 2;
+					uint64_t right = std::min(left + 1, image.cols() - 1);
+
+					// The sum of the largest floats overflows, their average does not
+					half(row, col) = static_cast<float>((static_cast<double>(image(top, left)) + image(top, right) + image(bottom, left) + image(bottom, right)) / 4);
+				}
+			}
+		});
+
+		return half;
+	}
+
+	// Bilinear interpolation of a pyramid level at the center of a full resolution pixel
+	static float sample_level(const matrix<float>& level, uint64_t scale, uint64_t row, uint64_t col) {
+
+		float y = std::clamp((row + 0.5f) / scale - 0.5f, 0.0f, static_cast<float>(level.rows() - 1));
+		float x = std::clamp((col + 0.5f) / scale - 0.5f, 0.0f, static_cast<float>(level.cols() - 1));
+
+		uint64_t top = static_cast<uint64_t>(y);
+		uint64_t left = static_cast<uint64_t>(x);
+		uint64_t bottom = std::min(top + 1, level.rows() - 1);
+		uint64_t right = std::min(left + 1, level.cols() - 1);
+
+		float dy = y - top;
+		float dx = x - left;
+
+		float upper = level(top, left) + (level(top, right) - level(top, left)) * dx;
+		float lower = level(bottom, left) + (level(bottom, right) - level(bottom, left)) * dx;
+
+		return upper + (lower - upper) * dy;
 	}
 
 public:
@@ -91,14 +467,16 @@ public:
 		std::string magic_number;
 		std::getline(input, magic_number);
 
-		char peek_char = input.peek();
-
 		std::unordered_map<std::string, std::string> variables;
 
 		while (true) {
 			std::string line;
 			std::getline(input, line);
 
+			if (!input) {
+				return;
+			}
+
 			if (line[0] == '#') {
 				continue;
 			}
@@ -117,112 +495,167 @@ public:
 
 		size_t y_index = resolution.find('Y');
 		size_t x_index = resolution.find('X');
+
+		if (y_index == std::string::npos || x_index == std::string::npos || x_index < y_index + 4) {
+			return;
+		}
+
 		std::string y_resolution = resolution.substr(y_index + 2, x_index - y_index - 4);
 		std::string x_resolution = resolution.substr(x_index + 2);
 
 		uint64_t y_resolution_value = std::stoi(y_resolution);
 		uint64_t x_resolution_value = std::stoi(x_resolution);
 
-		raster_.resize(y_resolution_value, x_resolution_value);
+		// The scanlines are decoded from memory
+		auto data_start = input.tellg();
+		input.seekg(0, std::ios::end);
+		auto data_size = static_cast<size_t>(input.tellg() - data_start);
+		input.seekg(data_start);
 
-		uint64_t read_rows = 0;
-		uint64_t read_columns = 0;
+		std::vector<uint8_t> data(data_size);
+		input.read(reinterpret_cast<char*>(data.data()), data_size);
 
-		// Read raster data
-		while (read_rows < y_resolution_value) {
+		// A quick pass over the commands finds the scanlines, which are then decoded in parallel
+		std::vector<size_t> offsets;
 
-			read_columns = 0;
+		if (!input || !find_scanlines(data.data(), data.size(), y_resolution_value, x_resolution_value, offsets)) {
+			return;
+		}
 
-			uint8_t scanline_byte1 = raw_read<uint8_t>(input);
-			uint8_t scanline_byte2 = raw_read<uint8_t>(input);
-			uint16_t number_of_columns = raw_read<uint8_t>(input) << 8 | raw_read<uint8_t>(input);
+		raster_.resize(y_resolution_value, x_resolution_value);
 
-			std::vector<uint8_t> line_data;
-			line_data.reserve(number_of_columns);
+		std::atomic<bool> decoded(true);
 
-			while (read_columns < static_cast<uint64_t>(number_of_columns) * 4) {
-				uint8_t command = raw_read<uint8_t>(input);
+		for_each_block(y_resolution_value, [&](uint64_t first_row, uint64_t last_row) {
 
-				if (command <= 127) {
+			std::vector<uint8_t> planes(x_resolution_value * 4);
 
-					// copy		
-					for (uint8_t i = 0; i < command; ++i) {
-						uint8_t command = raw_read<uint8_t>(input);
-						line_data.push_back(command);
-					}
+			for (uint64_t row = first_row; row < last_row; ++row) {
 
-					read_columns += command;
+				if (!decode_scanline(data.data() + offsets[row], x_resolution_value, planes.data())) {
+					decoded = false;
+					return;
 				}
-				else {
-
-					//run
-					uint8_t repeats = command - 128;
-					uint8_t symbol = raw_read<uint8_t>(input);
-
-					for (uint8_t i = 0; i < repeats; ++i) {
-						line_data.push_back(symbol);
-					}
 
-					read_columns += repeats;
-				}
+				convert_scanline(planes.data(), x_resolution_value, &raster_(row, 0));
 			}
+		});
 
-			// Copy line data into the raster
-			for (uint64_t col = 0; col < number_of_columns; ++col) {
-				uint8_t r = line_data[col];
-				uint8_t g = line_data[col + static_cast<uint64_t>(number_of_columns)];
-				uint8_t b = line_data[col + static_cast<uint64_t>(number_of_columns) * 2];
-				uint8_t e = line_data[col + static_cast<uint64_t>(number_of_columns) * 3];
-				raster_(read_rows, col) = { reconstruct_value(r, e), reconstruct_value(g, e), reconstruct_value(b, e) };
-			}
+		good_ = decoded;
+	}
 
-			read_rows++;
-		}
+	// False if the file could not be read or is not made of run length encoded scanlines
+	bool good() const {
+		return good_;
 	}
 
+	// Maps the range of all the channels to [0, 1] and applies the gamma
 	matrix<vec3b> compute_global_tone_mapping() {
 		matrix<vec3b> data(raster_.rows(), raster_.cols());
 
-		float min_value = std::numeric_limits<float>::max();;
+		// Each block of rows finds its own range
+		std::vector<std::array<float, 2>> ranges((raster_.rows() + block_rows - 1) / block_rows);
+
+		for_each_block(raster_.rows(), [&](uint64_t first_row, uint64_t last_row) {
+			float min_value = std::numeric_limits<float>::max();
+			float max_value = 0;
+
+			find_range(raster_(first_row, 0).data(), (last_row - first_row) * raster_.cols() * 3, min_value, max_value);
+
+			ranges[first_row / block_rows] = { min_value, max_value };
+		});
+
+		float min_value = std::numeric_limits<float>::max();
 		float max_value = 0;
 
-		for (const auto& item : raster_) {
-			if (item[0] < min_value) {
-				min_value = item[0];
-			}
-			if (item[1] < min_value) {
-				min_value = item[1];
-			}
-			if (item[2] < min_value) {
-				min_value = item[2];
-			}
-			if (item[0] > max_value) {
-				max_value = item[0];
-			}
-			if (item[1] > max_value) {
-				max_value = item[1];
-			}
-			if (item[2] > max_value) {
-				max_value = item[2];
-			}
+		for (const auto& range : ranges) {
+			min_value = std::min(min_value, range[0]);
+			max_value = std::max(max_value, range[1]);
 		}
 
 		float delta = max_value - min_value;
 
-		for (uint64_t row = 0; row < data.rows(); ++row) {
-			for (uint64_t col = 0; col < data.cols(); ++col) {
-				const auto& value = raster_(row, col);
+		const auto& gamma = display_gamma();
 
-				data(row, col) = {
-					map_tone(value[0], min_value, delta),
-					map_tone(value[1], min_value, delta),
-					map_tone(value[2], min_value, delta)
-				};
+		for_each_block(data.rows(), [&](uint64_t first_row, uint64_t last_row) {
+			for (uint64_t row = first_row; row < last_row; ++row) {
+				for (uint64_t col = 0; col < data.cols(); ++col) {
+					const auto& value = raster_(row, col);
+
+					data(row, col) = {
+						gamma((value[0] - min_value) / delta),
+						gamma((value[1] - min_value) / delta),
+						gamma((value[2] - min_value) / delta)
+					};
+				}
 			}
-		}
+		});
 
 		return data;
 	}
+
+	// Reinhard's global operator: the luminance is scaled so that its log average becomes key and compressed by
+	// L (1 + L / white^2) / (1 + L), where white, the largest scaled luminance, maps to 1
+	matrix<vec3b> compute_reinhard_tone_mapping(float key = 0.18f) {
+
+		float log_average;
+		float max_luminance;
+		luminance_statistics(log_average, max_luminance);
+
+		// In double: with a few bright pixels in a dark image the scaled luminance overflows a float, and the
+		// compressed one would be inf * 0
+		double scale = key / log_average;
+		double white = std::max(max_luminance * scale, 1e-6);
+		double inverse_white2 = 1 / (white * white);
+
+		return map_luminance([&](uint64_t, uint64_t, float world_luminance) {
+			double scaled = world_luminance * scale;
+			return static_cast<float>(scaled * (1 + scaled * inverse_white2) / (1 + scaled));
+		});
+	}
+
+	// Local version of the Reinhard operator: each pixel is compressed by the average luminance around it instead of
+	// its own, L (1 + L / white^2) / (1 + average). The averages are those of tiles of 2^tile_levels pixels, the top
+	// of a pyramid of halved luminance images, interpolated between the tile centers.
+	matrix<vec3b> compute_local_tone_mapping(float key = 0.18f, int tile_levels = 5) {
+
+		float log_average;
+		float max_luminance;
+		luminance_statistics(log_average, max_luminance);
+
+		// In double as in compute_reinhard_tone_mapping(), the pyramid keeps the luminance unscaled so that it
+		// stays finite
+		double scale = key / log_average;
+		double white = std::max(max_luminance * scale, 1e-6);
+		double inverse_white2 = 1 / (white * white);
+
+		if (raster_.rows() == 0 || raster_.cols() == 0) {
+			return matrix<vec3b>(raster_.rows(), raster_.cols());
+		}
+
+		matrix<float> level(raster_.rows(), raster_.cols());
+
+		for_each_block(level.rows(), [&](uint64_t first_row, uint64_t last_row) {
+			for (uint64_t row = first_row; row < last_row; ++row) {
+				for (uint64_t col = 0; col < level.cols(); ++col) {
+					level(row, col) = luminance(raster_(row, col));
+				}
+			}
+		});
+
+		uint64_t tile_size = 1;
+
+		for (int i = 0; i < tile_levels && (level.rows() > 1 || level.cols() > 1); ++i) {
+			level = downsample(level);
+			tile_size *= 2;
+		}
+
+		return map_luminance([&](uint64_t row, uint64_t col, float world_luminance) {
+			double scaled = world_luminance * scale;
+			double average = sample_level(level, tile_size, row, col) * scale;
+			return static_cast<float>(scaled * (1 + scaled * inverse_white2) / (1 + average));
+		});
+	}
 };
 
 class pam {
@@ -234,30 +667,22 @@ public:
 		raster_ = data;
 	}
 
-	void write(std::ofstream& output) {
-
-		output << "P7" << std::endl;
-		output << "WIDTH " << raster_.cols() << std::endl;
-		output << "HEIGHT " << raster_.rows() << std::endl;
-		output << "DEPTH " << "3" << std::endl;
-		output << "MAXVAL " << "255" << std::endl;
-		output << "TUPLTYPE " << "RGB" << std::endl;
-		output << "ENDHDR" << std::endl;
-
-		for (uint64_t row = 0; row < raster_.rows(); ++row) {
-			for (uint64_t col = 0; col < raster_.cols(); ++col) {
-				const auto& pixel = raster_(row, col);
-				raw_write<uint8_t>(output, pixel[0]);
-				raw_write<uint8_t>(output, pixel[1]);
-				raw_write<uint8_t>(output, pixel[2]);
-			}
-		}
+	bool write(std::ofstream& output) {
+		auto header = netpbm::pam_header(static_cast<uint32_t>(raster_.cols()), static_cast<uint32_t>(raster_.rows()), 3, 255, "RGB");
+		return netpbm::write(output, header, raster_.data());
 	}
 };
 
 int main(int argc, char* argv[]) {
 
-	if (argc != 3) {
+	// The optional third argument chooses the tone mapping: global (the default), reinhard or local
+	if (argc != 3 && argc != 4) {
+		return EXIT_FAILURE;
+	}
+
+	std::string tone_mapping = argc == 4 ? argv[3] : "global";
+
+	if (tone_mapping != "global" && tone_mapping != "reinhard" && tone_mapping != "local") {
 		return EXIT_FAILURE;
 	}
 
@@ -269,7 +694,21 @@ int main(int argc, char* argv[]) {
 
 	hdr hdr_image(input);
 
-	matrix<vec3b> data = hdr_image.compute_global_tone_mapping();
+	if (!hdr_image.good()) {
+		return EXIT_FAILURE;
+	}
+
+	matrix<vec3b> data;
+
+	if (tone_mapping == "reinhard") {
+		data = hdr_image.compute_reinhard_tone_mapping();
+	}
+	else if (tone_mapping == "local") {
+		data = hdr_image.compute_local_tone_mapping();
+	}
+	else {
+		data = hdr_image.compute_global_tone_mapping();
+	}
 
 	std::ofstream output(argv[2], std::ios::binary);
 
@@ -279,7 +718,9 @@ int main(int argc, char* argv[]) {
 
 	pam pam_image(data);
 
-	pam_image.write(output);
+	if (!pam_image.write(output)) {
+		return EXIT_FAILURE;
+	}
 
 	return EXIT_SUCCESS;
 }
\ No newline at end of file
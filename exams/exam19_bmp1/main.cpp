@@ -4,14 +4,11 @@
 #include <vector>
 #include <cmath>
 
+#include "../../support/netpbm/netpbm.h"
+
 using palette_item = std::array<uint8_t, 4>;
 using pixel_data = std::array<uint8_t, 3>;
 
-template<typename T>
-void raw_write(std::ostream& output, T value) {
-	output.write(reinterpret_cast<char*>(&value), sizeof(value));
-}
-
 class bit_reader {
 private:
 	std::istream& input_;
@@ -161,25 +158,23 @@ static matrix<pixel_data> read_bpm1(std::ifstream& input) {
 	return raster;
 }
 
-static void write_pam(std::ofstream& output, const matrix<pixel_data>& raster) {
+static bool write_pam(std::ofstream& output, const matrix<pixel_data>& raster) {
 	// The image data is stored in bgr format
 
-	output << "P7" << std::endl;
-	output << "WIDTH " << raster.cols() << std::endl;
-	output << "HEIGHT " << raster.rows() << std::endl;
-	output << "DEPTH " << 3 << std::endl;
-	output << "MAXVAL " << 255 << std::endl;
-	output << "TUPLTYPE " << "RGB" << std::endl;
-	output << "ENDHDR" << std::endl;
+	auto header = netpbm::pam_header(static_cast<uint32_t>(raster.cols()), static_cast<uint32_t>(raster.rows()), 3, 255, "RGB");
+	std::vector<uint8_t> samples(header.data_size());
+	auto output_sample = samples.begin();
 
 	for (uint64_t row = 0; row < raster.rows(); ++row) {
 		for (uint64_t col = 0; col < raster.cols(); ++col) {
 			const auto& pixel = raster(row, col);
-			raw_write(output, pixel[2]);
-			raw_write(output, pixel[1]);
-			raw_write(output, pixel[0]);
+			*output_sample++ = pixel[2];
+			*output_sample++ = pixel[1];
+			*output_sample++ = pixel[0];
 		}
 	}
+
+	return netpbm::write(output, header, samples.data());
 }
 
 int main(int argc, char* argv[]) {
@@ -202,7 +197,9 @@ int main(int argc, char* argv[]) {
 		return EXIT_FAILURE;
 	}
 
-	write_pam(output, bpm);
+	if (!write_pam(output, bpm)) {
+		return EXIT_FAILURE;
+	}
 
 	return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -6,6 +6,8 @@
 #include <map>
 #include <array>
 
+#include "../../support/netpbm/netpbm.h"
+
 uint8_t adam7_pattern[8][8]{
 		{1, 6, 4, 6, 2, 6, 4, 6},
 		{7, 7, 7, 7, 7, 7, 7, 7},
@@ -71,38 +73,25 @@ public:
 
 	uint32_t rows() const { return rows_; }
 	uint32_t cols() const { return cols_; }
+	T* data() { return data_.data(); }
+	const T* data() const { return data_.data(); }
 	const auto begin() const { return data_.begin(); }
 	const auto end() const { return data_.end(); }
 };
 
-static matrix<uint8_t> load_pgm(std::ifstream& input) {
-
-	std::string magic_number;
-	input >> magic_number >> std::ws;
-
-	if (input.peek() == '#') {
-		std::string comment;
-		std::getline(input, comment);
-	}
-
-	std::string width;
-	input >> width >> std::ws;
-
-	std::string height;
-	input >> height >> std::ws;
+static bool load_pgm(std::ifstream& input, matrix<uint8_t>& raster) {
 
-	std::string max_value;
-	input >> max_value >> std::ws;
+	netpbm::header header;
 
-	matrix<uint8_t> raster(std::stoi(height), std::stoi(width));
+	return netpbm::load(input, header, [&](const netpbm::header& info) -> void* {
 
-	for (uint32_t row = 0; row < raster.rows(); ++row) {
-		for (uint32_t col = 0; col < raster.cols(); ++col) {
-			raster(row, col) = raw_read<uint8_t>(input);
+		if (info.format != netpbm::format::pgm || info.max_value > 255) {
+			return nullptr;
 		}
-	}
 
-	return raster;
+		raster.resize(info.height, info.width);
+		return raster.data();
+	});
 }
 
 static std::map<uint8_t, std::vector<uint8_t>> apply_adam7_pattern(const matrix<uint8_t>& image) {
@@ -136,7 +125,13 @@ static bool compress(const std::string& input_file, const std::string& output_fi
 		return false;
 	}
 
-	matrix<uint8_t> pgm_image = load_pgm(input);
+	matrix<uint8_t> pgm_image;
+
+	if (!load_pgm(input, pgm_image)) {
+		std::cerr << "Failed to read the input image" << std::endl;
+		return false;
+	}
+
 	std::map<uint8_t, std::vector<uint8_t>> adam7_images = apply_adam7_pattern(pgm_image);
 
 	std::ofstream output(output_file, std::ios::binary);
@@ -163,23 +158,8 @@ static void write_pgm(std::string prefix, uint8_t index, const matrix<uint8_t>&
 
 	std::string file_name = prefix + "_" + std::to_string(index) + ".pgm";
 
-	std::ofstream output(file_name, std::ios::binary);
-
-	if (!output) {
-		std::cerr << "Failed to open output file" << std::endl;
-		return;
-	}
-
-	output << "P5" << std::endl;
-	output << image.cols() << " ";
-	output << image.rows() << std::endl;
-	output << 255 << std::endl;
-
-	for (uint32_t row = 0; row < image.rows(); ++row) {
-		for (uint32_t col = 0; col < image.cols(); ++col) {
-			uint8_t pixel = image(row, col);
-			raw_write(output, pixel);
-		}
+	if (!netpbm::write(file_name, netpbm::pgm_header(image.cols(), image.rows()), image.data())) {
+		std::cerr << "Failed to write output file" << std::endl;
 	}
 }
 
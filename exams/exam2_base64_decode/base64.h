@@ -1,4 +0,0 @@
-#pragma once
-#include <string>
-
-std::string base64_decode(const std::string& input);
\ No newline at end of file
@@ -1,5 +1,5 @@
 #include<iostream>
-#include "base64.h"
+#include "../../support/base64/base64.h"
 
 int main(int argc, char* argv[]) {
 	std::string test = "UHJldHR5IGxvbmcgdGV4dCB3aGljaCByZXF1aXJlcyBtb3JlIHRoYW4gNzYgY2hhcmFjdGVycyB0\nbyBlbmNvZGUgaXQgY29tcGxldGVseS4=";
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "mat.h"
+
+void PackBitsEncode(const mat<uint8_t>& img, std::vector<uint8_t>& encoded);
+
+// The last group is padded with EODs (128) instead of '='
+std::string Base64Encode(const std::vector<uint8_t>& v);
@@ -1,39 +1,31 @@
-#include <vector>
-#include <cstdint>
-#include "ppm.h"
-#include "mat.h"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include "pipeline.h"
 
-bool LoadPPM(const std::string& filename, mat<vec3b>& img);
-void SplitRGB(const mat<vec3b>& img, mat<uint8_t>& img_r, mat<uint8_t>& img_g, mat<uint8_t>& img_b);
-void PackBitsEncode(const mat<uint8_t>& img, std::vector<uint8_t>& encoded);
-std::string Base64Encode(const std::vector<uint8_t>& v);
+int main(int argc, char* argv[]) {
 
-int main(int arg, char* argv[]) {
-
-	mat<vec3b> img;
-
-	if (!LoadPPM(argv[1], img)) {
+	if (argc != 2 && argc != 5) {
+		std::cerr << "Usage: exam7_base64 <input ppm> [<red output> <green output> <blue output>]" << std::endl;
 		return EXIT_FAILURE;
 	}
 
-	mat<uint8_t> r;
-	mat<uint8_t> g;
-	mat<uint8_t> b;
-
-	SplitRGB(img, r, g, b);
-
-	std::vector<uint8_t> r_encoded;
-	PackBitsEncode(r, r_encoded);
+	if (argc == 2) {
+		std::ostringstream r_base64;
+		std::ostringstream g_base64;
+		std::ostringstream b_base64;
 
-	std::vector<uint8_t> g_encoded;
-	PackBitsEncode(g, g_encoded);
+		return EncodePPMChannels(argv[1], r_base64, g_base64, b_base64) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 
-	std::vector<uint8_t> b_encoded;
-	PackBitsEncode(b, b_encoded);
+	std::ofstream r_base64(argv[2], std::ios::binary);
+	std::ofstream g_base64(argv[3], std::ios::binary);
+	std::ofstream b_base64(argv[4], std::ios::binary);
 
-	std::string r_base64 = Base64Encode(r_encoded);
-	std::string g_base64 = Base64Encode(g_encoded);
-	std::string b_base64 = Base64Encode(b_encoded);
+	if (!r_base64 || !g_base64 || !b_base64) {
+		std::cerr << "Cannot open the output files" << std::endl;
+		return EXIT_FAILURE;
+	}
 
-	return EXIT_SUCCESS;
-}
\ No newline at end of file
+	return EncodePPMChannels(argv[1], r_base64, g_base64, b_base64) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
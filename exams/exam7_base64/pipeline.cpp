@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+#include "pipeline.h"
+#include "ppm.h"
+#include "../../support/base64/base64.h"
+#include "../../support/netpbm/netpbm.h"
+#include "../../support/planar/planar.h"
+#include "../../support/packbits/packbits.h"
+
+// Pixels read from the file for each block
+static constexpr size_t block_pixels = 1 << 18;
+
+// Blocks waiting in each queue, a stage stops when the next one falls this far behind
+static constexpr size_t queue_capacity = 4;
+
+template <typename T>
+class bounded_queue {
+	std::mutex mutex_;
+	std::condition_variable not_empty_;
+	std::condition_variable not_full_;
+	std::deque<T> items_;
+	size_t capacity_;
+	bool closed_ = false;
+
+public:
+	explicit bounded_queue(size_t capacity = queue_capacity) : capacity_(capacity) {}
+
+	// Waits while the queue is full
+	void push(T item) {
+		std::unique_lock lock(mutex_);
+		not_full_.wait(lock, [&] { return items_.size() < capacity_ || closed_; });
+
+		if (closed_) {
+			return;
+		}
+
+		items_.push_back(std::move(item));
+		not_empty_.notify_one();
+	}
+
+	// Waits for an item, nothing once the queue is closed and empty
+	std::optional<T> pop() {
+		std::unique_lock lock(mutex_);
+		not_empty_.wait(lock, [&] { return !items_.empty() || closed_; });
+
+		if (items_.empty()) {
+			return std::nullopt;
+		}
+
+		T item = std::move(items_.front());
+		items_.pop_front();
+		not_full_.notify_one();
+
+		return item;
+	}
+
+	void close() {
+		std::lock_guard lock(mutex_);
+		closed_ = true;
+		not_empty_.notify_all();
+		not_full_.notify_all();
+	}
+};
+
+// Base64 encoding of the PackBits stream of a channel, given its encoded rows a block at a time
+class channel_writer {
+	std::ostream& output_;
+	std::vector<char> base64_buffer_;
+	base64_encoder base64_;
+	size_t packbits_size_ = 0;
+
+	void write_base64(const uint8_t* data, size_t size) {
+		base64_buffer_.resize(base64_encoder::max_encoded_size(size));
+		size_t written = base64_.update(data, size, base64_buffer_.data());
+		output_.write(base64_buffer_.data(), written);
+		packbits_size_ += size;
+	}
+
+public:
+	explicit channel_writer(std::ostream& output) : output_(output) {}
+
+	// The rows are encoded without EOD, so they continue the same stream
+	void add(const packbits::encoded_rows& encoded) {
+		write_base64(encoded.data.data(), encoded.data.size());
+	}
+
+	// The EOD, then more EODs to pad the last base64 group
+	void finish() {
+		const uint8_t eods[3] = { 128, 128, 128 };
+		write_base64(eods, 1 + (3 - (packbits_size_ + 1) % 3) % 3);
+	}
+};
+
+bool EncodePPMChannels(const std::string& filename, std::ostream& red, std::ostream& green, std::ostream& blue) {
+
+	netpbm::row_reader reader(filename);
+	const auto& header = reader.info();
+
+	if (!reader.good() || header.format != netpbm::format::ppm || header.max_value > 255) {
+		return false;
+	}
+
+	std::array<channel_writer, 3> writers = { channel_writer(red), channel_writer(green), channel_writer(blue) };
+	bounded_queue<std::vector<vec3b>> queue;
+	std::array<bounded_queue<packbits::encoded_rows>, 3> encoded_queues;
+
+	bool complete = true;
+
+	{
+		// Each channel is base64 encoded and written by its own thread, as its blocks come out of PackBits
+		std::array<std::jthread, 3> channel_threads;
+
+		for (int channel = 0; channel < 3; ++channel) {
+			channel_threads[channel] = std::jthread([&, channel] {
+				while (auto encoded = encoded_queues[channel].pop()) {
+					writers[channel].add(*encoded);
+				}
+
+				writers[channel].finish();
+			});
+		}
+
+		// The blocks are split in planes, whose rows are encoded concurrently on the pool, while the reader goes on
+		std::jthread encoder([&] {
+			thread_pool pool;
+			std::array<std::vector<uint8_t>, 3> planes;
+			std::array<packbits::encoded_rows, 3> encoded;
+
+			while (auto pixels = queue.pop()) {
+				size_t rows = pixels->size() / header.width;
+
+				for (auto& plane : planes) {
+					plane.resize(pixels->size());
+				}
+
+				planar::deinterleave_rgb(reinterpret_cast<const uint8_t*>(pixels->data()), pixels->size(), planes[0].data(), planes[1].data(), planes[2].data());
+
+				std::array<packbits::plane, 3> inputs;
+
+				for (int channel = 0; channel < 3; ++channel) {
+					inputs[channel] = { planes[channel].data(), rows, header.width };
+				}
+
+				packbits::encode_rows(pool, inputs.data(), encoded.data(), 3);
+
+				for (int channel = 0; channel < 3; ++channel) {
+					encoded_queues[channel].push(std::move(encoded[channel]));
+				}
+			}
+
+			for (auto& encoded_queue : encoded_queues) {
+				encoded_queue.close();
+			}
+		});
+
+		// Whole rows in each block
+		uint32_t rows_per_block = std::max<uint32_t>(1, block_pixels / header.width);
+
+		while (reader.rows_left() > 0) {
+			std::vector<vec3b> pixels(static_cast<size_t>(std::min(rows_per_block, reader.rows_left())) * header.width);
+
+			if (reader.read_rows(pixels.data(), rows_per_block) == 0) {
+				complete = false;
+				break;
+			}
+
+			queue.push(std::move(pixels));
+		}
+
+		queue.close();
+	}
+
+	return complete && red && green && blue;
+}
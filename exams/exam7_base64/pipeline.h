@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+#include <ostream>
+
+// Writes for each channel of a PPM its PackBits encoding, in base64 padded with EODs as Base64Encode does.
+// Runs and copies are split at row boundaries, so the text can differ from encoding the whole plane at once.
+// The image is never loaded whole: blocks of rows flow from the reader to the encoder through a bounded queue,
+// and the encoder de-interleaves each block and PackBits encodes the rows of the three planes in parallel.
+bool EncodePPMChannels(const std::string& filename, std::ostream& red, std::ostream& green, std::ostream& blue);
@@ -4,51 +4,30 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <limits>
 #include "ppm.h"
 #include "mat.h"
+#include "json_writer.h"
+#include "../../support/base64/base64.h"
+#include "../../support/netpbm/netpbm.h"
+#include "../../support/planar/planar.h"
+#include "../../support/packbits/packbits.h"
 
 bool LoadPPM(const std::string& filename, mat<vec3b>& img) {
 
-	std::ifstream input(filename, std::ios::binary);
+	netpbm::header header;
 
-	if (!input) {
-		return false;
-	}
-
-	std::string magic_number;
-	input >> magic_number >> std::ws;
-
-	char comment_peek_char = input.peek();
-
-	if (comment_peek_char == '#') {
-		input.ignore(1);
-		std::string comment;
-		std::getline(input, comment);
-	}
-
-	std::string width;
-	input >> width >> std::ws;
-	int width_value = std::stoi(width);
-
-	std::string height;
-	input >> height >> std::ws;
-	int height_value = std::stoi(height);
+	return netpbm::load(filename, header, [&](const netpbm::header& info) -> void* {
 
-	std::string max_value;
-	input >> max_value >> std::ws;
-
-	img.resize(height_value, width_value);
-
-	for (int row = 0; row < height_value; ++row) {
-		for (int col = 0; col < width_value; ++col) {
-			auto& vec = img(row, col);
-			input.read(reinterpret_cast<char*>(&vec[0]), sizeof(vec[0]));
-			input.read(reinterpret_cast<char*>(&vec[1]), sizeof(vec[1]));
-			input.read(reinterpret_cast<char*>(&vec[2]), sizeof(vec[2]));
+		if (info.format != netpbm::format::ppm || info.max_value > 255 ||
+			static_cast<uint64_t>(info.width) * info.height > std::numeric_limits<int>::max()) {
+			return nullptr;
 		}
-	}
 
-	return true;
+		// The pixels are stored as consecutive RGB triplets, as in the file
+		img.resize(info.height, info.width);
+		return img.data();
+	});
 }
 
 void SplitRGB(const mat<vec3b>& img, mat<uint8_t>& img_r, mat<uint8_t>& img_g, mat<uint8_t>& img_b) {
@@ -57,175 +36,175 @@ void SplitRGB(const mat<vec3b>& img, mat<uint8_t>& img_r, mat<uint8_t>& img_g, m
 	img_g.resize(img.rows(), img.cols());
 	img_b.resize(img.rows(), img.cols());
 
-	for (int row = 0; row < img.rows(); ++row) {
-		for (int col = 0; col < img.cols(); ++col) {
-
-			const auto& pixel = img(row, col);
-			img_r(row, col) = pixel[0];
-			img_g(row, col) = pixel[1];
-			img_b(row, col) = pixel[2];
-		}
-	}
+	// The pixels are consecutive RGB triplets
+	planar::deinterleave_rgb(reinterpret_cast<const uint8_t*>(img.data()), img.size(), img_r.data(), img_g.data(), img_b.data());
 }
 
-static void write_run(std::vector<uint8_t>& buffer, std::vector<uint8_t>& encoded) {
-	uint8_t run_byte = 257 - static_cast<uint8_t>(buffer.size());
-	encoded.push_back(run_byte);
-	encoded.push_back(buffer.front());
-	buffer.clear();
-}
+void PackBitsEncode(const mat<uint8_t>& img, std::vector<uint8_t>& encoded) {
 
-static void write_copy(std::vector<uint8_t>& buffer, std::vector<uint8_t>& encoded) {
-	uint8_t copy_byte = static_cast<uint8_t>(buffer.size()) - 1;
-	encoded.push_back(copy_byte);
-	std::copy(buffer.begin(), buffer.end(), std::back_inserter(encoded));
-	buffer.clear();
-}
+	packbits::encode_span(img.data(), img.size(), encoded);
 
-void PackBitsEncode(const mat<uint8_t>& img, std::vector<uint8_t>& encoded) {
+	encoded.push_back(128); // EOD
+}
 
-	bool is_run = true;
+std::string Base64Encode(const std::vector<uint8_t>& v) {
 
-	std::vector<uint8_t> buffer;
+	// The last group is padded with EODs (128) instead of '='
+	size_t remainder = v.size() % 3;
 
-	for (const auto& pixel : img) {
+	std::string output = base64_encode(v.data(), v.size() - remainder);
 
-		if (buffer.size() > 0) {
+	if (remainder > 0) {
+		uint8_t last_group[3] = { 128, 128, 128 };
+		std::copy(v.end() - remainder, v.end(), last_group);
+		output += base64_encode(last_group, 3);
+	}
 
-			auto previous_value = buffer.back();
+	return output;
+}
 
-			if (is_run) {
+// Pixels read from the file for each PackBits block
+static constexpr size_t block_pixels = 1 << 20;
 
-				if (pixel != previous_value) {
-					write_run(buffer, encoded);
+// Bytes given to the base64 encoder at a time, their encoding always fits in the writer buffer
+static constexpr size_t base64_block_size = 3 << 16;
 
-					if (buffer.size() == 1) {
-						is_run = false;
-					}
-				}
-			}
-			else {
+static bool IsSupportedPPM(const netpbm::header& info) {
+	return info.format == netpbm::format::ppm && info.max_value <= 255;
+}
 
-				if (pixel == previous_value) {
-					buffer.pop_back();
-					write_copy(buffer, encoded);
-					buffer.push_back(previous_value);
-					is_run = true;
-				}
-			}
+// The base64 of a channel written in pieces into the current string of the writer
+class channel_base64 {
+private:
+	json_writer& writer_;
+	base64_encoder base64_;
+	size_t bytes_ = 0;
+
+public:
+	channel_base64(json_writer& writer) : writer_(writer) {}
+
+	void write(const uint8_t* data, size_t size) {
+		for (size_t i = 0; i < size; i += base64_block_size) {
+			size_t block_size = std::min(base64_block_size, size - i);
+			char* output = writer_.raw_data(base64_encoder::max_encoded_size(block_size));
+			writer_.commit_raw_data(base64_.update(data + i, block_size, output));
 		}
 
-		buffer.push_back(pixel);
+		bytes_ += size;
 	}
 
-	if (buffer.size() > 0) {
-		if (is_run) {
-			write_run(buffer, encoded);
-		}
-		else {
-			write_copy(buffer, encoded);
-		}
+	// The EOD, then more EODs to pad the last base64 group
+	void finish() {
+		const uint8_t eods[3] = { 128, 128, 128 };
+		write(eods, 1 + (3 - (bytes_ + 1) % 3) % 3);
 	}
+};
 
-	encoded.push_back(128);
-}
+// The image is read once, a block of rows at a time, and never loaded whole. The rows of the three channels of
+// each block are encoded in parallel without EOD, so their concatenation is a single PackBits stream for each
+// channel. Red is written as it is encoded, the PackBits of green and blue is kept until the red string is complete.
+bool JSON(const std::string& filename, json_writer& writer) {
 
-static uint8_t map_bits_to_char(uint8_t bits_group) {
+	netpbm::row_reader reader(filename);
+	netpbm::header info = reader.info();
 
-	if (bits_group <= 25) {
-		return 'A' + bits_group;
-	}
-	else if (bits_group >= 26 && bits_group <= 51) {
-		return 'a' + bits_group - 26;
-	}
-	else if (bits_group >= 52 && bits_group <= 61) {
-		return '0' + bits_group - 52;
-	}
-	else if (bits_group == 62) {
-		return '+';
-	}
-	else if (bits_group == 63) {
-		return '/';
-	}
-	else {
-		return '?';
+	if (!reader.good() || !IsSupportedPPM(info)) {
+		writer.begin_object().end_object();
+		return false;
 	}
-}
 
-std::string Base64Encode(const std::vector<uint8_t>& v) {
+	thread_pool pool;
 
-	std::vector<uint8_t> data(v.begin(), v.end());
+	uint32_t rows_per_block = static_cast<uint32_t>(std::max<size_t>(1, block_pixels / info.width));
 
-	size_t remainder = v.size() % 3;
+	std::vector<uint8_t> pixels;
+	std::vector<uint8_t> planes[3];
+	packbits::encoded_rows encoded[3];
+	std::vector<uint8_t> pending[2];
+	bool complete = true;
 
-	size_t padding_bytes = remainder == 0 ? 0 : 3 - remainder;
+	writer.begin_object();
 
-	for (size_t i = 0; i < padding_bytes; ++i) {
-		data.push_back(128);
-	}
+	writer.key("width").value(info.width);
+	writer.key("height").value(info.height);
+
+	writer.key("red").begin_string();
+	channel_base64 red(writer);
 
-	std::string output;
+	while (reader.rows_left() > 0) {
+		uint32_t rows = reader.read_rows(pixels, rows_per_block);
 
-	for (size_t i = 0; i < data.size(); i += 3) {
-		uint32_t combined = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+		if (rows == 0) {
+			complete = false;
+			break;
+		}
 
-		uint8_t group1 = (combined >> 18) & 0b111111;
-		uint8_t converted1 = map_bits_to_char(group1);
-		output.push_back(converted1);
+		size_t pixels_count = static_cast<size_t>(rows) * info.width;
 
-		uint8_t group2 = (combined >> 12) & 0b111111;
-		uint8_t converted2 = map_bits_to_char(group2);
-		output.push_back(converted2);
+		for (auto& plane : planes) {
+			plane.resize(pixels_count);
+		}
 
-		uint8_t group3 = (combined >> 6) & 0b111111;
-		uint8_t converted3 = map_bits_to_char(group3);
-		output.push_back(converted3);
+		planar::deinterleave_rgb(pixels.data(), pixels_count, planes[0].data(), planes[1].data(), planes[2].data());
 
-		uint8_t group4 = combined & 0b111111;
-		uint8_t converted4 = map_bits_to_char(group4);
-		output.push_back(converted4);
+		packbits::plane inputs[3] = {
+			{ planes[0].data(), rows, info.width },
+			{ planes[1].data(), rows, info.width },
+			{ planes[2].data(), rows, info.width },
+		};
+
+		packbits::encode_rows(pool, inputs, encoded, 3);
+
+		red.write(encoded[0].data.data(), encoded[0].data.size());
+		pending[0].insert(pending[0].end(), encoded[1].data.begin(), encoded[1].data.end());
+		pending[1].insert(pending[1].end(), encoded[2].data.begin(), encoded[2].data.end());
 	}
 
-	return output;
-}
+	red.finish();
+	writer.end_string();
 
-std::string JSON(const std::string& filename) {
+	const char* keys[2] = { "green", "blue" };
 
-	mat<vec3b> img;
+	for (int channel = 0; channel < 2; ++channel) {
+		writer.key(keys[channel]).begin_string();
 
-	if(!LoadPPM(filename, img)){
-		return std::string("{}");
+		channel_base64 output(writer);
+		output.write(pending[channel].data(), pending[channel].size());
+		output.finish();
+
+		writer.end_string();
 	}
 
-	mat<uint8_t> r;
-	mat<uint8_t> g;
-	mat<uint8_t> b;
+	writer.end_object();
 
-	SplitRGB(img, r, g, b);
+	return complete;
+}
 
-	std::vector<uint8_t> r_encoded;
-	PackBitsEncode(r, r_encoded);
+bool JSON(const std::string& filename, std::ostream& output) {
 
-	std::vector<uint8_t> g_encoded;
-	PackBitsEncode(g, g_encoded);
+	json_writer writer(output);
 
-	std::vector<uint8_t> b_encoded;
-	PackBitsEncode(b, b_encoded);
+	bool loaded = JSON(filename, writer);
+	writer.flush();
 
-	std::string r_base64 = Base64Encode(r_encoded);
-	std::string g_base64 = Base64Encode(g_encoded);
-	std::string b_base64 = Base64Encode(b_encoded);
+	return loaded && writer.good();
+}
 
-	std::ostringstream string_stream;
+bool JSON(const std::string& filename, int fd) {
+
+	json_writer writer(fd);
 
-	string_stream << "{" << std::endl;
+	bool loaded = JSON(filename, writer);
+	writer.flush();
 
-	string_stream << "\t" << "\"width\": " << img.cols() << "," << std::endl;
-	string_stream << "\t" << "\"height\": " << img.rows() << "," << std::endl;
-	string_stream << "\t" << "\"red\": \"" << r_base64 << "\"," << std::endl;
-	string_stream << "\t" << "\"green\": \"" << g_base64 << "\"," << std::endl;
-	string_stream << "\t" << "\"blue\": \"" << b_base64 << "\"" << std::endl;
-	string_stream << "}";
+	return loaded && writer.good();
+}
+
+std::string JSON(const std::string& filename) {
 
-	return string_stream.str();
-}
\ No newline at end of file
+	std::ostringstream string_stream;
+
+	JSON(filename, string_stream);
+
+	return std::move(string_stream).str();
+}
@@ -0,0 +1,262 @@
+#include "json_writer.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// Characters that cannot appear unescaped in a JSON string
+static constexpr std::array<bool, 256> needs_escape = [] {
+	std::array<bool, 256> table{};
+
+	for (int c = 0; c < 0x20; ++c) {
+		table[c] = true;
+	}
+
+	table['"'] = true;
+	table['\\'] = true;
+
+	return table;
+}();
+
+json_writer::json_writer(std::ostream& output, size_t buffer_size) : stream_(&output), buffer_(buffer_size) {}
+
+json_writer::json_writer(int fd, size_t buffer_size) : fd_(fd), buffer_(buffer_size) {}
+
+json_writer::~json_writer() {
+	flush();
+}
+
+void json_writer::write_to_sink(const char* data, size_t size) {
+
+	if (failed_) {
+		return;
+	}
+
+	if (stream_ != nullptr) {
+		stream_->write(data, size);
+		failed_ = !*stream_;
+		return;
+	}
+
+	// Partial writes are possible on pipes and sockets
+	while (size > 0) {
+#if defined(_WIN32)
+		auto written = _write(fd_, data, static_cast<unsigned int>(std::min<size_t>(size, 1 << 30)));
+#else
+		auto written = ::write(fd_, data, size);
+#endif
+
+		if (written <= 0) {
+			failed_ = true;
+			return;
+		}
+
+		data += written;
+		size -= static_cast<size_t>(written);
+	}
+}
+
+void json_writer::flush() {
+	write_to_sink(buffer_.data(), used_);
+	used_ = 0;
+
+	if (stream_ != nullptr && !failed_) {
+		stream_->flush();
+	}
+}
+
+void json_writer::write(const char* data, size_t size) {
+
+	if (buffer_.size() - used_ < size) {
+		flush();
+
+		// Large blocks skip the buffer
+		if (size >= buffer_.size()) {
+			write_to_sink(data, size);
+			return;
+		}
+	}
+
+	std::memcpy(buffer_.data() + used_, data, size);
+	used_ += size;
+}
+
+void json_writer::write(char c) {
+
+	if (used_ == buffer_.size()) {
+		flush();
+	}
+
+	buffer_[used_++] = c;
+}
+
+void json_writer::write_escaped(std::string_view text) {
+
+	static constexpr char hex_digits[] = "0123456789abcdef";
+
+	// Characters not needing escapes are written in runs
+	size_t run_begin = 0;
+
+	for (size_t i = 0; i < text.size(); ++i) {
+		uint8_t c = static_cast<uint8_t>(text[i]);
+
+		if (!needs_escape[c]) {
+			continue;
+		}
+
+		write(text.data() + run_begin, i - run_begin);
+		run_begin = i + 1;
+
+		switch (c) {
+		case '"': write("\\\"", 2); break;
+		case '\\': write("\\\\", 2); break;
+		case '\n': write("\\n", 2); break;
+		case '\r': write("\\r", 2); break;
+		case '\t': write("\\t", 2); break;
+		case '\b': write("\\b", 2); break;
+		case '\f': write("\\f", 2); break;
+		default: {
+			char escape[6] = { '\\', 'u', '0', '0', hex_digits[c >> 4], hex_digits[c & 0xF] };
+			write(escape, sizeof(escape));
+		}
+		}
+	}
+
+	write(text.data() + run_begin, text.size() - run_begin);
+}
+
+void json_writer::begin_item() {
+
+	if (scopes_.empty()) {
+		return;
+	}
+
+	auto& current = scopes_.back();
+
+	if (!current.empty) {
+		write(',');
+	}
+
+	current.empty = false;
+
+	write('\n');
+
+	for (size_t i = 0; i < scopes_.size(); ++i) {
+		write('\t');
+	}
+}
+
+void json_writer::begin_scope(char open, bool is_object) {
+
+	// Members already had their separator written by key()
+	if (scopes_.empty() || !scopes_.back().is_object) {
+		begin_item();
+	}
+
+	write(open);
+	scopes_.push_back({ is_object, true });
+}
+
+void json_writer::end_scope(char close) {
+
+	bool empty = scopes_.back().empty;
+	scopes_.pop_back();
+
+	if (!empty) {
+		write('\n');
+
+		for (size_t i = 0; i < scopes_.size(); ++i) {
+			write('\t');
+		}
+	}
+
+	write(close);
+}
+
+json_writer& json_writer::begin_object() {
+	begin_scope('{', true);
+	return *this;
+}
+
+json_writer& json_writer::end_object() {
+	end_scope('}');
+	return *this;
+}
+
+json_writer& json_writer::begin_array() {
+	begin_scope('[', false);
+	return *this;
+}
+
+json_writer& json_writer::end_array() {
+	end_scope(']');
+	return *this;
+}
+
+json_writer& json_writer::key(std::string_view name) {
+	begin_item();
+	write('"');
+	write_escaped(name);
+	write("\": ", 3);
+	return *this;
+}
+
+json_writer& json_writer::value(int64_t number) {
+
+	if (!scopes_.empty() && !scopes_.back().is_object) {
+		begin_item();
+	}
+
+	char digits[24];
+	auto result = std::to_chars(digits, digits + sizeof(digits), number);
+	write(digits, result.ptr - digits);
+
+	return *this;
+}
+
+json_writer& json_writer::value(std::string_view text) {
+	begin_string();
+	write_escaped(text);
+	return end_string();
+}
+
+json_writer& json_writer::begin_string() {
+
+	if (!scopes_.empty() && !scopes_.back().is_object) {
+		begin_item();
+	}
+
+	write('"');
+
+	return *this;
+}
+
+json_writer& json_writer::string_data(std::string_view text) {
+	write_escaped(text);
+	return *this;
+}
+
+json_writer& json_writer::end_string() {
+	write('"');
+	return *this;
+}
+
+char* json_writer::raw_data(size_t size) {
+
+	if (buffer_.size() - used_ < size) {
+		flush();
+	}
+
+	return buffer_.data() + used_;
+}
+
+void json_writer::commit_raw_data(size_t size) {
+	used_ += size;
+}
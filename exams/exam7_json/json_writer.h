@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// Writes JSON directly to a stream or a file descriptor through its own buffer.
+// Members and elements go on their own lines, indented with tabs.
+class json_writer {
+	struct scope {
+		bool is_object;
+		bool empty;
+	};
+
+	std::ostream* stream_ = nullptr;
+	int fd_ = -1;
+	std::vector<char> buffer_;
+	size_t used_ = 0;
+	bool failed_ = false;
+	std::vector<scope> scopes_;
+
+	void write_to_sink(const char* data, size_t size);
+	void write(const char* data, size_t size);
+	void write(char c);
+	void write_escaped(std::string_view text);
+
+	// Separator and indentation before a member or an element
+	void begin_item();
+	void begin_scope(char open, bool is_object);
+	void end_scope(char close);
+
+public:
+	static constexpr size_t default_buffer_size = 1 << 20;
+
+	explicit json_writer(std::ostream& output, size_t buffer_size = default_buffer_size);
+	explicit json_writer(int fd, size_t buffer_size = default_buffer_size);
+	~json_writer();
+
+	json_writer(const json_writer&) = delete;
+	json_writer& operator=(const json_writer&) = delete;
+
+	json_writer& begin_object();
+	json_writer& end_object();
+	json_writer& begin_array();
+	json_writer& end_array();
+
+	json_writer& key(std::string_view name);
+
+	json_writer& value(int64_t number);
+	json_writer& value(std::string_view text);
+
+	// Strings written in pieces: begin_string(), any number of string_data() or raw_data(), end_string()
+	json_writer& begin_string();
+	json_writer& string_data(std::string_view text);
+	json_writer& end_string();
+
+	// Space for up to size characters that need no escaping (as base64), written in place and then committed.
+	// size must not be larger than the buffer.
+	char* raw_data(size_t size);
+	void commit_raw_data(size_t size);
+
+	void flush();
+
+	bool good() const {
+		return !failed_;
+	}
+};
@@ -1,8 +1,28 @@
 #include <string>
+#include <fstream>
+#include <iostream>
 
 std::string JSON(const std::string& filename);
+bool JSON(const std::string& filename, std::ostream& output);
+
+int main(int argc, char* argv[]) {
+
+	if (argc < 2) {
+		std::cerr << "Usage: exam7_json <input ppm> [output json]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (argc < 3) {
+		std::string json = JSON(argv[1]);
+		return EXIT_SUCCESS;
+	}
+
+	// The JSON is streamed to the file, without keeping it in memory
+	std::ofstream output(argv[2], std::ios::binary);
+
+	if (!output || !JSON(argv[1], output)) {
+		return EXIT_FAILURE;
+	}
 
-int main(int arg, char* argv[]) {
-	std::string json = JSON(argv[1]);
 	return EXIT_SUCCESS;
 }
\ No newline at end of file
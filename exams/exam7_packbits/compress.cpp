@@ -1,66 +1,35 @@
 #include <vector>
 #include <cstdint>
-#include <algorithm>
-#include "mat.h"
+#include <utility>
 
-static void write_run(std::vector<uint8_t>& buffer, std::vector<uint8_t>& encoded) {
-	uint8_t run_byte = 257 - static_cast<uint8_t>(buffer.size());
-	encoded.push_back(run_byte);
-	encoded.push_back(buffer.front());
-	buffer.clear();
-}
-
-static void write_copy(std::vector<uint8_t>& buffer, std::vector<uint8_t>& encoded) {
-	uint8_t copy_byte = static_cast<uint8_t>(buffer.size()) - 1;
-	encoded.push_back(copy_byte);
-	std::copy(buffer.begin(), buffer.end(), std::back_inserter(encoded));
-	buffer.clear();
-}
+#include "compress.h"
 
 void PackBitsEncode(const mat<uint8_t>& img, std::vector<uint8_t>& encoded) {
 
-	bool is_run = true;
-
-	std::vector<uint8_t> buffer;
-
-	for (const auto& pixel : img) {
-
-		if (buffer.size() > 0) {
-
-			auto previous_value = buffer.back();
+	packbits::encode_span(img.data(), img.size(), encoded);
 
-			if (is_run) {
-				
-				if (pixel != previous_value) {
-					write_run(buffer, encoded);
+	encoded.push_back(128); // EOD
+}
 
-					if (buffer.size() == 1) {
-						is_run = false;
-					}
-				}
-			}
-			else {
+static packbits::plane as_plane(const mat<uint8_t>& img) {
+	return { img.data(), static_cast<size_t>(img.rows()), static_cast<size_t>(img.cols()) };
+}
 
-				if (pixel == previous_value) {
-					buffer.pop_back();
-					write_copy(buffer, encoded);
-					buffer.push_back(previous_value);
-					is_run = true;
-				}
-			}
-		}
+void PackBitsEncodeRows(const mat<uint8_t>& img, packbits_rows& encoded) {
+	thread_pool pool;
+	packbits::plane plane = as_plane(img);
+	packbits::encode_rows(pool, &plane, &encoded, 1);
+}
 
-		buffer.push_back(pixel);
-	}
+void PackBitsEncodeRowsRGB(const mat<uint8_t>& img_r, const mat<uint8_t>& img_g, const mat<uint8_t>& img_b,
+	packbits_rows& encoded_r, packbits_rows& encoded_g, packbits_rows& encoded_b) {
+	thread_pool pool;
+	packbits::plane planes[] = { as_plane(img_r), as_plane(img_g), as_plane(img_b) };
+	packbits_rows encoded[3];
 
-	if (buffer.size() > 0) {
-		if (is_run) {
-			write_run(buffer, encoded);
-		}
-		else {
-			write_copy(buffer, encoded);
-		}
-	}
+	packbits::encode_rows(pool, planes, encoded, 3);
 
-	encoded.push_back(128); // EOD
-}
\ No newline at end of file
+	encoded_r = std::move(encoded[0]);
+	encoded_g = std::move(encoded[1]);
+	encoded_b = std::move(encoded[2]);
+}
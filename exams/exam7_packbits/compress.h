@@ -0,0 +1,17 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "mat.h"
+#include "../../support/packbits/packbits.h"
+
+using packbits_rows = packbits::encoded_rows;
+
+void PackBitsEncode(const mat<uint8_t>& img, std::vector<uint8_t>& encoded);
+
+void PackBitsEncodeRows(const mat<uint8_t>& img, packbits_rows& encoded);
+
+// The three planes are encoded concurrently, sharing the same worker threads
+void PackBitsEncodeRowsRGB(const mat<uint8_t>& img_r, const mat<uint8_t>& img_g, const mat<uint8_t>& img_b,
+	packbits_rows& encoded_r, packbits_rows& encoded_g, packbits_rows& encoded_b);
@@ -2,10 +2,10 @@
 #include <cstdint>
 #include "ppm.h"
 #include "mat.h"
+#include "compress.h"
 
 bool LoadPPM(const std::string& filename, mat<vec3b>& img);
 void SplitRGB(const mat<vec3b>& img, mat<uint8_t>& img_r, mat<uint8_t>& img_g, mat<uint8_t>& img_b);
-void PackBitsEncode(const mat<uint8_t>& img, std::vector<uint8_t>& encoded);
 
 int main(int arg, char* argv[]) {
 
@@ -21,14 +21,11 @@ int main(int arg, char* argv[]) {
 
 	SplitRGB(img, r, g, b);
 
-	std::vector<uint8_t> r_encoded;
-	PackBitsEncode(r, r_encoded);
+	packbits_rows r_encoded;
+	packbits_rows g_encoded;
+	packbits_rows b_encoded;
 
-	std::vector<uint8_t> g_encoded;
-	PackBitsEncode(g, g_encoded);
-
-	std::vector<uint8_t> b_encoded;
-	PackBitsEncode(b, b_encoded);
+	PackBitsEncodeRowsRGB(r, g, b, r_encoded, g_encoded, b_encoded);
 
 	return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -8,6 +8,11 @@
 #include <algorithm>
 #include <functional>
 #include <iterator>
+#include <memory>
+
+#include "../../support/netpbm/netpbm.h"
+#include "../../support/huffman/decoding.h"
+#include "../../support/huffman/table_cache.h"
 
 template<typename T>
 T raw_read(std::ifstream& input, size_t size = sizeof(T)) {
@@ -16,11 +21,6 @@ T raw_read(std::ifstream& input, size_t size = sizeof(T)) {
 	return value;
 }
 
-template<typename T>
-void raw_write(std::ofstream& output, T value) {
-	output.write(reinterpret_cast<char*>(&value), sizeof(value));
-}
-
 class bit_reader {
 private:
 	std::ifstream& input_;
@@ -100,163 +100,107 @@ public:
 	}
 };
 
-struct symbol_data {
-	uint64_t symbol = 0;
-	uint64_t length = 0;
-	uint64_t code = 0;
+// A prefix code, immutable once built so it can be shared. A code with a single symbol takes no bits.
+struct prefix_code {
+	decoding::huffman_decode_table<uint16_t> table;
+	size_t symbols = 0;
+	uint16_t first_symbol = 0;
 };
 
 class huffman {
 private:
-	std::unordered_map<uint64_t, symbol_data> symbols_data_;
-	std::vector<symbol_data> sorted_symbols_data_;
+	std::shared_ptr<const prefix_code> code_;
 
-	std::vector<symbol_data> create_sorted_table() {
+	// Process-wide LRU cache of the decoding tables indexed by their code lengths: the same prefix codes
+	// recur across images and prefix groups, so they are built only once
+	static decoding::table_cache<std::vector<uint64_t>, prefix_code>& code_cache() {
+		static decoding::table_cache<std::vector<uint64_t>, prefix_code> cache(256);
+		return cache;
+	}
 
-		std::vector<symbol_data> sorted_data;
+	// The symbols with length 0 are not in the code. nullptr if the lengths don't describe a code.
+	static std::shared_ptr<const prefix_code> build_prefix_code(const std::vector<uint64_t>& lengths) {
 
-		for (const auto& item : symbols_data_) {
-			sorted_data.push_back(item.second);
-		}
+		auto code = std::make_shared<prefix_code>();
 
-		std::sort(sorted_data.begin(), sorted_data.end(), [](const symbol_data& first, const symbol_data& second) {
-			if (first.length == second.length) {
-				return first.symbol < second.symbol;
+		for (uint64_t i = 0; i < lengths.size(); ++i) {
+			if (lengths[i] != 0 && code->symbols++ == 0) {
+				code->first_symbol = static_cast<uint16_t>(i);
 			}
+		}
 
-			return first.length < second.length;
-			});
+		if (!code->table.build_from_lengths(lengths)) {
+			return nullptr;
+		}
 
-		return sorted_data;
+		return code;
 	}
 
-	static uint64_t default_decode_symbol(bit_reader& bitstream, const symbol_data& read_symbol,
+	static uint64_t default_decode_symbol(bit_reader& bitstream, uint64_t symbol,
 		const uint64_t& current_index, std::vector<uint64_t>& decoded_output) {
 		uint64_t read_symbols = 1;
-		decoded_output[current_index] = read_symbol.symbol;
+		decoded_output[current_index] = symbol;
 		return read_symbols;
 	}
 
-	void create_canonical_code() {
-
-		// Create symbols vector sorted by lenght then by symbol
-		sorted_symbols_data_ = create_sorted_table();
-
-		uint64_t code = 0;
-		uint64_t current_length = 0;
-
-		// Calculate canonical code
-		for (const auto& item : sorted_symbols_data_) {
-			uint64_t shifts = item.length - current_length;
-			current_length = item.length;
-			code = code << shifts;
-			symbols_data_[item.symbol].code = code;
-			code++;
-		}
-
-		// Refresh the vector with the new data
-		sorted_symbols_data_ = create_sorted_table();
-	}
-
 public:
 	huffman() {}
 
-	huffman(const std::vector<uint64_t>& lenghts) {
-
-		// Create symbols map
-		for (uint64_t i = 0; i < lenghts.size(); ++i) {
-
-			// Ignore symbols with lenght = 0
-			if (lenghts[i] == 0) {
-				continue;
-			}
-
-			symbol_data& symbol = symbols_data_[i];
-			symbol.symbol = i;
-			symbol.length = lenghts[i];
-		}
-
-		create_canonical_code();
-	}
-
-	huffman(const std::vector<symbol_data>& symbols) {
-
-		// Create symbols map
-		for (uint64_t i = 0; i < symbols.size(); ++i) {
-
-			// Ignore symbols with lenght = 0
-			if (symbols[i].length == 0) {
-				continue;
-			}
-
-			symbol_data& symbol = symbols_data_[symbols[i].symbol];
-			symbol.symbol = symbols[i].symbol;
-			symbol.length = symbols[i].length;
-		}
+	// The code length of every symbol, the symbol being the index
+	huffman(const std::vector<uint64_t>& lenghts) : code_(code_cache().get(lenghts, build_prefix_code)) {}
 
-		create_canonical_code();
+	// Hits, misses and evictions of the decoding tables shared by all the prefix codes
+	static decoding::cache_statistics table_cache_statistics() {
+		return code_cache().stats();
 	}
 
 	std::vector<uint64_t> read_from_bitstream(bit_reader& bitstream, uint32_t max_symbols,
 		std::function <uint64_t(
 			bit_reader& bitstream,
-			const symbol_data& read_symbol,
+			uint64_t symbol,
 			const uint64_t& current_index,
 			std::vector<uint64_t>& decoded_output)> symbol_decode_func = default_decode_symbol) {
 
-		uint64_t current_code = 0;
-		uint64_t current_code_length = 0;
 		uint64_t read_symbols = 0;
 
 		std::vector<uint64_t> decoded_output(max_symbols);
 
+		if (!code_) {
+			return decoded_output;
+		}
+
 		// If there is only one symbol then don't read from the stream
-		if (sorted_symbols_data_.size() == 1) {
-			decoded_output.push_back(sorted_symbols_data_.back().symbol);
+		if (code_->symbols == 1) {
+			decoded_output.push_back(code_->first_symbol);
 			return decoded_output;
 		}
 
 		// For each symbol to be read
 		while (read_symbols < max_symbols) {
-			uint64_t bit = bitstream.read_bit();
-			current_code = (current_code << 1) | bit;
-			current_code_length++;
-
-			// For each code in the codes table
-			for (const auto& symbol_data : sorted_symbols_data_) {
-
-				if (symbol_data.length != current_code_length) {
-					continue;
-				}
-
-				// Found a match
-				if (current_code == symbol_data.code) {
-
-					uint64_t parsed_symbols = symbol_decode_func(bitstream, symbol_data,
-						read_symbols, decoded_output);
 
-					read_symbols += parsed_symbols;
+			auto decoded = code_->table.decode_bits([&] { return bitstream.read_bit(); });
 
-					current_code = 0;
-					current_code_length = 0;
-					break;
-				}
+			if (decoded.second == 0) {
+				std::cerr << "Invalid prefix code in the stream." << std::endl;
+				break;
 			}
+
+			read_symbols += symbol_decode_func(bitstream, decoded.first, read_symbols, decoded_output);
 		}
 
 		return decoded_output;
 	}
 };
 
-static uint64_t decode_symbol(bit_reader& bitstream, const symbol_data& read_symbol,
+static uint64_t decode_symbol(bit_reader& bitstream, uint64_t symbol,
 	const uint64_t& current_index, std::vector<uint64_t>& decoded_output) {
 
-	if (read_symbol.symbol < 16) {
+	if (symbol < 16) {
 		uint64_t read_symbols = 1;
-		decoded_output[current_index] = read_symbol.symbol;
+		decoded_output[current_index] = symbol;
 		return read_symbols;
 	}
-	else if (read_symbol.symbol == 16) {
+	else if (symbol == 16) {
 		uint64_t repeat = 3 + bitstream.read_number(2);
 
 		uint64_t previous_value = decoded_output[current_index - 1u];
@@ -268,7 +212,7 @@ static uint64_t decode_symbol(bit_reader& bitstream, const symbol_data& read_sym
 
 		return repeat;
 	}
-	else if (read_symbol.symbol == 17) {
+	else if (symbol == 17) {
 		uint64_t repeat = 3 + bitstream.read_number(3);
 
 		for (uint64_t i = 0; i < repeat; ++i) {
@@ -277,7 +221,7 @@ static uint64_t decode_symbol(bit_reader& bitstream, const symbol_data& read_sym
 
 		return repeat;
 	}
-	else if (read_symbol.symbol == 18) {
+	else if (symbol == 18) {
 		uint64_t repeat = 11 + bitstream.read_number(7);
 
 		for (uint32_t i = 0; i < repeat; ++i) {
@@ -302,18 +246,17 @@ static huffman read_prefix_code(bit_reader& bitstream, uint32_t index) {
 		uint8_t is_first_8bits = static_cast<uint8_t>(bitstream.read_bit());
 		uint64_t symbol0 = bitstream.read_number(1 + 7 * is_first_8bits);
 
-		std::vector<symbol_data> symbols_data(kCodeLengthCodes);
+		// Symbols of 8 bits at most, both 1 bit long
+		std::vector<uint64_t> lengths(256);
 
-		symbols_data[0].symbol = symbol0;
-		symbols_data[0].length = 1;
+		lengths[symbol0] = 1;
 
 		if (num_symbols == 2) {
 			uint64_t symbol1 = bitstream.read_number(8);
-			symbols_data[1].symbol = symbol1;
-			symbols_data[1].length = 1;
+			lengths[symbol1] = 1;
 		}
 
-		huffman h(symbols_data);
+		huffman h(lengths);
 
 		return h;
 	}
@@ -486,30 +429,31 @@ static matrix<argb> decode_webp(std::ifstream& input) {
 	return raster;
 }
 
-static void write_pam(std::ofstream& output, const matrix<argb>& image) {
+static bool write_pam(std::ofstream& output, const matrix<argb>& image) {
 
-	output << "P7" << std::endl;
-	output << "WIDTH " << image.cols() << std::endl;
-	output << "HEIGHT " << image.rows() << std::endl;
-	output << "DEPTH " << 4 << std::endl;
-	output << "MAXVAL " << 255 << std::endl;
-	output << "TUPLTYPE " << "RGBA" << std::endl;
-	output << "ENDHDR" << std::endl;
+	auto header = netpbm::pam_header(static_cast<uint32_t>(image.cols()), static_cast<uint32_t>(image.rows()), 4, 255, "RGBA");
+	std::vector<uint8_t> samples(header.data_size());
+	auto output_sample = samples.begin();
 
 	for (uint64_t row = 0; row < image.rows(); ++row) {
 		for (uint64_t col = 0; col < image.cols(); ++col) {
 			argb pixel = image(row, col);
-			raw_write(output, pixel[1]);
-			raw_write(output, pixel[2]);
-			raw_write(output, pixel[3]);
-			raw_write(output, pixel[0]);
+			*output_sample++ = pixel[1];
+			*output_sample++ = pixel[2];
+			*output_sample++ = pixel[3];
+			*output_sample++ = pixel[0];
 		}
 	}
+
+	return netpbm::write(output, header, samples.data());
 }
 
 int main(int argc, char* argv[]) {
 
-	if (argc != 3) {
+	// An optional --cache-stats writes the counters of the prefix codes cache to stderr
+	bool cache_stats = argc == 4 && std::string(argv[3]) == "--cache-stats";
+
+	if (argc != 3 && !cache_stats) {
 		return EXIT_FAILURE;
 	}
 
@@ -521,13 +465,19 @@ int main(int argc, char* argv[]) {
 
 	matrix<argb> raster = decode_webp(input);
 
+	if (cache_stats) {
+		std::cerr << "Prefix codes cache: " << huffman::table_cache_statistics() << std::endl;
+	}
+
 	std::ofstream output(argv[2], std::ios::binary);
 
 	if (!output) {
 		return EXIT_FAILURE;
 	}
 
-	write_pam(output, raster);
+	if (!write_pam(output, raster)) {
+		return EXIT_FAILURE;
+	}
 
 	return EXIT_SUCCESS;
 };
\ No newline at end of file
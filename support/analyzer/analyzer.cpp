@@ -0,0 +1,682 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <array>
+#include <queue>
+#include <future>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+// Dry-run cost models of the project codecs: each one returns the number of bytes the encoder
+// would produce for a block, following the rules of the corresponding format without writing anything.
+
+// Same rules of assignments/packbits: runs of at least 2 equal bytes, everything else is copied,
+// both limited to 128 bytes per command
+class packbits_cost {
+public:
+	static uint64_t estimate(const uint8_t* data, size_t size) {
+
+		uint64_t cost = 1; // EOD
+		uint64_t literals = 0;
+
+		auto flush_literals = [&]() {
+			cost += literals + (literals + 127) / 128;
+			literals = 0;
+		};
+
+		size_t i = 0;
+
+		while (i < size) {
+
+			size_t run = 1;
+
+			while (i + run < size && data[i + run] == data[i]) {
+				run++;
+			}
+
+			if (run >= 2) {
+				flush_literals();
+
+				cost += 2 * (run / 128);
+
+				// A single byte left over from a split run goes with the literals
+				if (run % 128 == 1) {
+					literals++;
+				}
+				else if (run % 128 > 1) {
+					cost += 2;
+				}
+			}
+			else {
+				literals++;
+			}
+
+			i += run;
+		}
+
+		flush_literals();
+
+		return cost;
+	}
+};
+
+// A parse in literals and matches shared by the LZ77 family codecs (LZ4 and Snappy): greedy, 64 KiB window,
+// matches of at least 4 bytes found through a hash of the next 4 bytes
+class lz77_parser {
+private:
+	static constexpr uint32_t hash_bits = 16;
+	static constexpr size_t min_match = 4;
+	static constexpr size_t max_offset = 65535;
+
+	std::vector<uint32_t> hash_table_ = std::vector<uint32_t>(size_t(1) << hash_bits);
+
+	static uint32_t read32(const uint8_t* data) {
+		uint32_t value = 0;
+		std::memcpy(&value, data, sizeof(value));
+		return value;
+	}
+
+	static uint32_t hash(uint32_t value) {
+		return (value * 2654435761u) >> (32 - hash_bits);
+	}
+
+public:
+	// The visitor receives literals(count), match(offset, length) and end(final literals)
+	template<typename Visitor>
+	void parse(const uint8_t* data, size_t size, Visitor& visitor) {
+
+		std::fill(hash_table_.begin(), hash_table_.end(), 0);
+
+		// LZ4 requires the last 5 bytes to be literals and the last match to start 12 bytes before the end
+		size_t match_limit = size > 12 ? size - 12 : 0;
+		size_t end_limit = size > 5 ? size - 5 : 0;
+
+		size_t anchor = 0;
+		size_t i = 0;
+
+		while (i < match_limit) {
+
+			uint32_t value = read32(data + i);
+			uint32_t& slot = hash_table_[hash(value)];
+
+			// Positions are stored + 1, so that 0 means empty
+			size_t candidate = slot;
+			slot = static_cast<uint32_t>(i + 1);
+
+			if (candidate == 0 || i + 1 - candidate > max_offset || read32(data + candidate - 1) != value) {
+				i++;
+				continue;
+			}
+
+			candidate--;
+
+			size_t length = min_match;
+
+			while (i + length < end_limit && data[candidate + length] == data[i + length]) {
+				length++;
+			}
+
+			visitor.literals(i - anchor);
+			visitor.match(i - candidate, length);
+
+			i += length;
+			anchor = i;
+		}
+
+		visitor.end(size - anchor);
+	}
+};
+
+// Format of exams/exam16_lz4: 12 bytes of header, then blocks preceded by their 4 bytes size
+class lz4_cost {
+private:
+	uint64_t cost_ = 0;
+	uint64_t pending_literals_ = 0;
+
+	static uint64_t length_extension(uint64_t length) {
+		return length >= 15 ? (length - 15) / 255 + 1 : 0;
+	}
+
+public:
+	static constexpr uint64_t header_size = 12;
+	static constexpr uint64_t block_overhead = 4;
+
+	void literals(uint64_t count) {
+		pending_literals_ = count;
+	}
+
+	void match(uint64_t /*offset*/, uint64_t length) {
+		cost_ += 1 + length_extension(pending_literals_) + pending_literals_ + 2 + length_extension(length - 4);
+		pending_literals_ = 0;
+	}
+
+	void end(uint64_t count) {
+		cost_ += 1 + length_extension(count) + count + block_overhead;
+	}
+
+	uint64_t cost() const {
+		return cost_;
+	}
+};
+
+// Format of exams/exam9_snappy_decoding: varint of the uncompressed size, then literal and copy tags
+class snappy_cost {
+private:
+	uint64_t cost_ = 0;
+
+	static uint64_t literal_cost(uint64_t count) {
+
+		if (count == 0) {
+			return 0;
+		}
+
+		uint64_t tag = 1;
+
+		if (count > 60) {
+			for (uint64_t value = count - 1; value > 0; value >>= 8) {
+				tag++;
+			}
+		}
+
+		return tag + count;
+	}
+
+public:
+	static uint64_t header_size(uint64_t uncompressed_size) {
+		uint64_t bytes = 1;
+
+		while (uncompressed_size >= 128) {
+			uncompressed_size >>= 7;
+			bytes++;
+		}
+
+		return bytes;
+	}
+
+	void literals(uint64_t count) {
+		cost_ += literal_cost(count);
+	}
+
+	void match(uint64_t offset, uint64_t length) {
+
+		// Copies with 1 byte offset hold lengths from 4 to 11 and offsets up to 2047
+		if (length <= 11 && offset < 2048) {
+			cost_ += 2;
+			return;
+		}
+
+		// Otherwise copies with 2 bytes offset of up to 64 bytes each
+		cost_ += 3 * ((length + 63) / 64);
+	}
+
+	void end(uint64_t count) {
+		cost_ += literal_cost(count);
+	}
+
+	uint64_t cost() const {
+		return cost_;
+	}
+};
+
+// Collects the match lengths found by the parser
+class match_histogram {
+public:
+	// Buckets: 4, 5-8, 9-16, ..., 257 and longer
+	static constexpr size_t buckets = 8;
+
+	std::array<uint64_t, buckets> counts{};
+	uint64_t matched_bytes = 0;
+
+	void literals(uint64_t) {}
+
+	void match(uint64_t, uint64_t length) {
+		size_t bucket = 0;
+
+		while (bucket + 1 < buckets && length > (uint64_t(4) << bucket)) {
+			bucket++;
+		}
+
+		counts[bucket]++;
+		matched_bytes += length;
+	}
+
+	void end(uint64_t) {}
+};
+
+// Forwards the parse to several visitors, so that the block is parsed only once
+template<typename... Visitors>
+class visitor_group {
+private:
+	std::tuple<Visitors&...> visitors_;
+
+public:
+	visitor_group(Visitors&... visitors) : visitors_(visitors...) {}
+
+	void literals(uint64_t count) {
+		std::apply([&](auto&... visitor) { (visitor.literals(count), ...); }, visitors_);
+	}
+
+	void match(uint64_t offset, uint64_t length) {
+		std::apply([&](auto&... visitor) { (visitor.match(offset, length), ...); }, visitors_);
+	}
+
+	void end(uint64_t count) {
+		std::apply([&](auto&... visitor) { (visitor.end(count), ...); }, visitors_);
+	}
+};
+
+// Huffman code lengths from a histogram, as the encoders build them: the zero frequencies get no code and a
+// single symbol gets a code of 0 bits. While a code is longer than max_length, the length field of the format,
+// the frequencies are halved and the code is built again, as bzip2 does.
+template<size_t Size>
+std::array<uint8_t, Size> huffman_code_lengths(std::array<uint64_t, Size> frequencies, uint32_t max_length) {
+
+	std::array<uint8_t, Size> lengths{};
+
+	struct node {
+		uint64_t frequency;
+		int32_t parent;
+	};
+
+	while (true) {
+
+		std::vector<node> nodes;
+
+		using queue_item = std::pair<uint64_t, int32_t>;
+		std::priority_queue<queue_item, std::vector<queue_item>, std::greater<queue_item>> queue;
+
+		for (size_t symbol = 0; symbol < Size; ++symbol) {
+			if (frequencies[symbol] > 0) {
+				queue.push(queue_item(frequencies[symbol], static_cast<int32_t>(nodes.size())));
+				nodes.push_back({ frequencies[symbol], -1 });
+			}
+		}
+
+		while (queue.size() > 1) {
+			auto first = queue.top();
+			queue.pop();
+			auto second = queue.top();
+			queue.pop();
+
+			int32_t merged = static_cast<int32_t>(nodes.size());
+			nodes.push_back({ first.first + second.first, -1 });
+			nodes[first.second].parent = merged;
+			nodes[second.second].parent = merged;
+
+			queue.push(queue_item(first.first + second.first, merged));
+		}
+
+		size_t leaf = 0;
+		uint32_t longest = 0;
+
+		for (size_t symbol = 0; symbol < Size; ++symbol) {
+
+			if (frequencies[symbol] == 0) {
+				continue;
+			}
+
+			uint32_t depth = 0;
+
+			for (int32_t parent = nodes[leaf].parent; parent != -1; parent = nodes[parent].parent) {
+				depth++;
+			}
+
+			lengths[symbol] = static_cast<uint8_t>(std::min<uint32_t>(depth, 255));
+			longest = std::max(longest, depth);
+			leaf++;
+		}
+
+		if (longest <= max_length) {
+			return lengths;
+		}
+
+		for (auto& frequency : frequencies) {
+			if (frequency > 0) {
+				frequency = frequency / 2 + 1;
+			}
+		}
+	}
+}
+
+// Format of assignments/huffman2: magic, table size, 13 bits per table entry (5 bits for the length),
+// 32 bits symbol count, codes
+static uint64_t huffman_cost(const std::array<uint64_t, 256>& frequencies) {
+
+	auto lengths = huffman_code_lengths(frequencies, 31);
+
+	uint64_t bits = 8 * 8 + 8 + 32;
+
+	for (size_t symbol = 0; symbol < lengths.size(); ++symbol) {
+		if (frequencies[symbol] > 0) {
+			bits += 13 + frequencies[symbol] * lengths[symbol];
+		}
+	}
+
+	return (bits + 7) / 8;
+}
+
+// Format of assignments/huffdiff: magic, width and height, 14 bits per table entry (5 bits for the length),
+// codes of the residuals
+static uint64_t huffdiff_cost(const std::array<uint64_t, 512>& residuals) {
+
+	auto lengths = huffman_code_lengths(residuals, 31);
+
+	uint64_t bits = 9;
+
+	for (size_t symbol = 0; symbol < lengths.size(); ++symbol) {
+		if (residuals[symbol] > 0) {
+			bits += 14 + residuals[symbol] * lengths[symbol];
+		}
+	}
+
+	return 8 + 4 + 4 + (bits + 7) / 8;
+}
+
+// Everything measured on a block, blocks are analyzed in parallel and then merged
+struct block_statistics {
+
+	// Buckets: 1, 2, 3-4, 5-8, ..., 129 and longer
+	static constexpr size_t run_buckets = 9;
+
+	uint64_t size = 0;
+
+	std::array<uint64_t, 256> order0{};
+	std::vector<uint64_t> order1 = std::vector<uint64_t>(256 * 256); // previous byte * 256 + byte
+
+	// Difference from the previous byte, offset by 256 (the huffdiff residuals of a single row)
+	std::array<uint64_t, 512> residuals{};
+
+	std::array<uint64_t, run_buckets> runs{};
+	uint64_t number_of_runs = 0;
+
+	match_histogram matches;
+
+	uint64_t packbits = 0;
+	uint64_t lz4 = 0;
+	uint64_t snappy = 0;
+
+	void merge(const block_statistics& other) {
+
+		size += other.size;
+
+		for (size_t i = 0; i < order0.size(); ++i) {
+			order0[i] += other.order0[i];
+		}
+
+		for (size_t i = 0; i < order1.size(); ++i) {
+			order1[i] += other.order1[i];
+		}
+
+		for (size_t i = 0; i < residuals.size(); ++i) {
+			residuals[i] += other.residuals[i];
+		}
+
+		for (size_t i = 0; i < runs.size(); ++i) {
+			runs[i] += other.runs[i];
+		}
+
+		number_of_runs += other.number_of_runs;
+
+		for (size_t i = 0; i < matches.counts.size(); ++i) {
+			matches.counts[i] += other.matches.counts[i];
+		}
+
+		matches.matched_bytes += other.matches.matched_bytes;
+
+		packbits += other.packbits;
+		lz4 += other.lz4;
+		snappy += other.snappy;
+	}
+};
+
+// previous_byte is the last byte of the previous block, -1 for the first one
+static block_statistics analyze_block(const std::vector<uint8_t>& data, int32_t previous_byte) {
+
+	block_statistics statistics;
+	statistics.size = data.size();
+
+	uint32_t previous = previous_byte >= 0 ? static_cast<uint32_t>(previous_byte) : 0;
+	bool has_previous = previous_byte >= 0;
+
+	for (const auto& value : data) {
+		statistics.order0[value]++;
+
+		if (has_previous) {
+			statistics.order1[previous * 256 + value]++;
+			statistics.residuals[static_cast<int32_t>(value) - static_cast<int32_t>(previous) + 256]++;
+		}
+		else {
+			// The first sample is stored as it is
+			statistics.residuals[value + 256]++;
+			has_previous = true;
+		}
+
+		previous = value;
+	}
+
+	for (size_t i = 0; i < data.size();) {
+
+		size_t run = 1;
+
+		while (i + run < data.size() && data[i + run] == data[i]) {
+			run++;
+		}
+
+		size_t bucket = 0;
+
+		while (bucket + 1 < block_statistics::run_buckets && run > (size_t(1) << bucket)) {
+			bucket++;
+		}
+
+		statistics.runs[bucket]++;
+		statistics.number_of_runs++;
+
+		i += run;
+	}
+
+	statistics.packbits = packbits_cost::estimate(data.data(), data.size());
+
+	lz77_parser parser;
+	lz4_cost lz4;
+	snappy_cost snappy;
+
+	visitor_group<lz4_cost, snappy_cost, match_histogram> visitors(lz4, snappy, statistics.matches);
+	parser.parse(data.data(), data.size(), visitors);
+
+	statistics.lz4 = lz4.cost();
+	// Each block is a Snappy stream with its own header, the last one can be shorter
+	statistics.snappy = snappy_cost::header_size(data.size()) + snappy.cost();
+
+	return statistics;
+}
+
+static double order0_entropy(const std::array<uint64_t, 256>& frequencies, uint64_t total) {
+
+	double entropy = 0;
+
+	for (const auto& frequency : frequencies) {
+		if (frequency > 0) {
+			double p = static_cast<double>(frequency) / total;
+			entropy -= p * std::log2(p);
+		}
+	}
+
+	return entropy;
+}
+
+// Conditional entropy of a byte given the previous one
+static double order1_entropy(const std::vector<uint64_t>& frequencies) {
+
+	double entropy = 0;
+	uint64_t total = 0;
+
+	for (size_t context = 0; context < 256; ++context) {
+
+		uint64_t context_total = 0;
+
+		for (size_t symbol = 0; symbol < 256; ++symbol) {
+			context_total += frequencies[context * 256 + symbol];
+		}
+
+		for (size_t symbol = 0; symbol < 256; ++symbol) {
+
+			uint64_t frequency = frequencies[context * 256 + symbol];
+
+			if (frequency > 0) {
+				double p = static_cast<double>(frequency) / context_total;
+				entropy -= frequency * std::log2(p);
+			}
+		}
+
+		total += context_total;
+	}
+
+	return total > 0 ? entropy / total : 0;
+}
+
+static void print_report(const block_statistics& statistics) {
+
+	uint64_t size = statistics.size;
+
+	std::cout << "Size: " << size << " bytes" << std::endl;
+
+	if (size == 0) {
+		return;
+	}
+
+	std::cout << std::fixed << std::setprecision(4);
+	std::cout << "Order-0 entropy: " << order0_entropy(statistics.order0, size) << " bits/byte" << std::endl;
+	std::cout << "Order-1 entropy: " << order1_entropy(statistics.order1) << " bits/byte" << std::endl;
+
+	std::cout << std::endl << "Runs: " << statistics.number_of_runs
+		<< " (average length " << static_cast<double>(size) / statistics.number_of_runs << ")" << std::endl;
+
+	for (size_t i = 0; i < statistics.runs.size(); ++i) {
+		uint64_t low = i == 0 ? 1 : (uint64_t(1) << (i - 1)) + 1;
+		uint64_t high = uint64_t(1) << i;
+
+		std::string range = std::to_string(low);
+
+		if (i + 1 == statistics.runs.size()) {
+			range += "+";
+		}
+		else if (high > low) {
+			range += "-" + std::to_string(high);
+		}
+
+		std::cout << "  " << std::setw(8) << range << ": " << statistics.runs[i] << std::endl;
+	}
+
+	std::cout << std::endl << "Matches (64 KiB window): " << statistics.matches.matched_bytes << " bytes matched ("
+		<< 100.0 * statistics.matches.matched_bytes / size << "%)" << std::endl;
+
+	for (size_t i = 0; i < statistics.matches.counts.size(); ++i) {
+		uint64_t low = i == 0 ? 4 : (uint64_t(4) << (i - 1)) + 1;
+		uint64_t high = uint64_t(4) << i;
+
+		std::string range = std::to_string(low);
+
+		if (i + 1 == statistics.matches.counts.size()) {
+			range += "+";
+		}
+		else if (high > low) {
+			range += "-" + std::to_string(high);
+		}
+
+		std::cout << "  " << std::setw(8) << range << ": " << statistics.matches.counts[i] << std::endl;
+	}
+
+	// Block based codecs are estimated per block
+	std::vector<std::pair<std::string, uint64_t>> costs = {
+		{ "PackBits", statistics.packbits },
+		{ "LZ4", lz4_cost::header_size + statistics.lz4 },
+		{ "Snappy", statistics.snappy },
+		{ "Huffman", huffman_cost(statistics.order0) },
+		{ "huffdiff", huffdiff_cost(statistics.residuals) },
+	};
+
+	std::cout << std::endl << "Predicted sizes:" << std::endl;
+
+	for (const auto& cost : costs) {
+		std::cout << "  " << std::left << std::setw(10) << cost.first << std::right << std::setw(16) << cost.second
+			<< " bytes, ratio " << static_cast<double>(size) / cost.second << std::endl;
+	}
+}
+
+int main(int argc, char* argv[]) {
+
+	if (argc < 2 || argc > 3) {
+		std::cerr << "Usage: analyzer <input file> [threads]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::ifstream input(argv[1], std::ios::binary);
+
+	if (!input) {
+		std::cerr << "Cannot open the input file" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	size_t threads = std::max(1u, std::thread::hardware_concurrency());
+
+	if (argc == 3) {
+		threads = std::max(1, std::stoi(argv[2]));
+	}
+
+	// The file is streamed in blocks: while a batch of blocks is analyzed the next one is read,
+	// so at most 2 * threads blocks are in memory
+	constexpr size_t block_size = 8 << 20;
+
+	block_statistics total;
+	int32_t previous_byte = -1;
+
+	auto read_batch = [&]() {
+		std::vector<std::pair<std::vector<uint8_t>, int32_t>> batch;
+
+		for (size_t i = 0; i < threads; ++i) {
+			std::vector<uint8_t> block(block_size);
+			input.read(reinterpret_cast<char*>(block.data()), block.size());
+			block.resize(static_cast<size_t>(input.gcount()));
+
+			if (block.empty()) {
+				break;
+			}
+
+			int32_t block_previous_byte = previous_byte;
+			previous_byte = block.back();
+
+			batch.emplace_back(std::move(block), block_previous_byte);
+		}
+
+		return batch;
+	};
+
+	auto batch = read_batch();
+
+	while (!batch.empty()) {
+
+		std::vector<std::future<block_statistics>> results;
+
+		for (const auto& block : batch) {
+			results.push_back(std::async(std::launch::async, analyze_block, std::cref(block.first), block.second));
+		}
+
+		auto next_batch = read_batch();
+
+		for (auto& result : results) {
+			total.merge(result.get());
+		}
+
+		batch = std::move(next_batch);
+	}
+
+	print_report(total);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,500 @@
+#include "base64.h"
+#include <cstdint>
+#include <vector>
+
+#include "../cpu_features/cpu_features.h"
+
+static constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Decoding values above 63 mark the characters that are not part of the alphabet
+static constexpr uint8_t invalid = 0xFF;
+static constexpr uint8_t whitespace = 0xFE;
+static constexpr uint8_t padding = 0xFD;
+
+struct decoding_table {
+	uint8_t values[256];
+};
+
+static constexpr decoding_table create_decoding_table() {
+
+	decoding_table table{};
+
+	for (int c = 0; c < 256; ++c) {
+		table.values[c] = invalid;
+	}
+
+	for (int i = 0; i < 64; ++i) {
+		table.values[static_cast<uint8_t>(alphabet[i])] = static_cast<uint8_t>(i);
+	}
+
+	table.values[' '] = whitespace;
+	table.values['\t'] = whitespace;
+	table.values['\r'] = whitespace;
+	table.values['\n'] = whitespace;
+	table.values['='] = padding;
+
+	return table;
+}
+
+static constexpr decoding_table decoding = create_decoding_table();
+
+enum class simd_level { scalar, ssse3, avx2 };
+
+static simd_level cpu_simd_level() {
+	static const simd_level level = cpu_features::has_avx2() ? simd_level::avx2 :
+		cpu_features::has_ssse3() ? simd_level::ssse3 : simd_level::scalar;
+	return level;
+}
+
+#if defined(CPU_X86)
+
+// The vector code follows Mula and Lemire, "Faster Base64 Encoding and Decoding Using AVX2 Instructions".
+// Each function processes whole blocks and returns the number of input bytes consumed.
+
+CPU_TARGET("ssse3")
+static __m128i encode_indices_ssse3(__m128i input) {
+
+	// Gathers each group of 3 bytes in 32 bits, then moves each 6 bits group in its own byte
+	input = _mm_shuffle_epi8(input, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+	__m128i t0 = _mm_and_si128(input, _mm_set1_epi32(0x0FC0FC00));
+	__m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	__m128i t2 = _mm_and_si128(input, _mm_set1_epi32(0x003F03F0));
+	__m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+
+	return _mm_or_si128(t1, t3);
+}
+
+CPU_TARGET("ssse3")
+static __m128i encode_characters_ssse3(__m128i indices) {
+
+	// Selects the offset of the range of each index: A-Z, a-z, 0-9, + or /
+	__m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+	__m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+	range = _mm_or_si128(range, _mm_and_si128(less, _mm_set1_epi8(13)));
+
+	const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+	return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+}
+
+CPU_TARGET("ssse3")
+static size_t encode_ssse3(const uint8_t* input, size_t size, char* output) {
+
+	size_t i = 0;
+
+	// 12 bytes are encoded in 16 characters, but 16 are loaded
+	for (; i + 16 <= size; i += 12) {
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+		__m128i characters = encode_characters_ssse3(encode_indices_ssse3(block));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output), characters);
+		output += 16;
+	}
+
+	return i;
+}
+
+CPU_TARGET("avx2")
+static size_t encode_avx2(const uint8_t* input, size_t size, char* output) {
+
+	const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+		10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+	const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+	size_t i = 0;
+
+	// 24 bytes are encoded in 32 characters, 12 for each lane, but 28 are loaded
+	for (; i + 28 <= size; i += 24) {
+		__m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+		__m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i + 12));
+		__m256i block = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+
+		block = _mm256_shuffle_epi8(block, shuffle);
+
+		__m256i t0 = _mm256_and_si256(block, _mm256_set1_epi32(0x0FC0FC00));
+		__m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		__m256i t2 = _mm256_and_si256(block, _mm256_set1_epi32(0x003F03F0));
+		__m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+		__m256i indices = _mm256_or_si256(t1, t3);
+
+		__m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+		__m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+		range = _mm256_or_si256(range, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+
+		__m256i characters = _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(output), characters);
+		output += 32;
+	}
+
+	return i;
+}
+
+// Stops at the first block with a character outside the alphabet (whitespaces and padding included),
+// leaving it to the scalar code. 12 bytes are written for each 16 characters, but 16 are stored.
+CPU_TARGET("ssse3")
+static size_t decode_ssse3(const char* input, size_t size, uint8_t* output) {
+
+	const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+	const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i mask_2f = _mm_set1_epi8(0x2F);
+
+	size_t i = 0;
+
+	for (; i + 16 <= size; i += 16) {
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+
+		__m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(block, 4), mask_2f);
+		__m128i lo_nibbles = _mm_and_si128(block, mask_2f);
+		__m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+		__m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xFFFF) {
+			break;
+		}
+
+		__m128i eq_2f = _mm_cmpeq_epi8(block, mask_2f);
+		__m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+		__m128i values = _mm_add_epi8(block, roll);
+
+		// Merges 4 values of 6 bits in 24 bits, then removes the unused byte of each group
+		__m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+		merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+		merged = _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output), merged);
+		output += 12;
+	}
+
+	return i;
+}
+
+// As decode_ssse3, 24 bytes are written for each 32 characters, but 32 are stored.
+CPU_TARGET("avx2")
+static size_t decode_avx2(const char* input, size_t size, uint8_t* output) {
+
+	const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+	const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i mask_2f = _mm256_set1_epi8(0x2F);
+	const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+	size_t i = 0;
+
+	for (; i + 32 <= size; i += 32) {
+		__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+
+		__m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(block, 4), mask_2f);
+		__m256i lo_nibbles = _mm256_and_si256(block, mask_2f);
+		__m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+		__m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+
+		if (!_mm256_testz_si256(lo, hi)) {
+			break;
+		}
+
+		__m256i eq_2f = _mm256_cmpeq_epi8(block, mask_2f);
+		__m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+		__m256i values = _mm256_add_epi8(block, roll);
+
+		__m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+		merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+		merged = _mm256_shuffle_epi8(merged, pack);
+		merged = _mm256_permutevar8x32_epi32(merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(output), merged);
+		output += 24;
+	}
+
+	return i;
+}
+
+#endif
+
+static void encode_group(uint32_t bits, char* output) {
+	output[0] = alphabet[(bits >> 18) & 0b111111];
+	output[1] = alphabet[(bits >> 12) & 0b111111];
+	output[2] = alphabet[(bits >> 6) & 0b111111];
+	output[3] = alphabet[bits & 0b111111];
+}
+
+size_t base64_encoder::update(const uint8_t* data, size_t size, char* output) {
+
+	char* out = output;
+
+	// Completes the group left from the previous call
+	while (pending_size_ > 0 && pending_size_ < 3 && size > 0) {
+		pending_[pending_size_++] = *data++;
+		size--;
+	}
+
+	if (pending_size_ == 3) {
+		encode_group((pending_[0] << 16) | (pending_[1] << 8) | pending_[2], out);
+		out += 4;
+		pending_size_ = 0;
+	}
+
+	size_t i = 0;
+
+#if defined(CPU_X86)
+	switch (cpu_simd_level()) {
+	case simd_level::avx2:
+		i = encode_avx2(data, size, out);
+		break;
+	case simd_level::ssse3:
+		i = encode_ssse3(data, size, out);
+		break;
+	default:
+		break;
+	}
+
+	out += i / 3 * 4;
+#endif
+
+	for (; i + 3 <= size; i += 3) {
+		encode_group((data[i] << 16) | (data[i + 1] << 8) | data[i + 2], out);
+		out += 4;
+	}
+
+	for (; i < size; ++i) {
+		pending_[pending_size_++] = data[i];
+	}
+
+	return out - output;
+}
+
+size_t base64_encoder::finish(char* output) {
+
+	if (pending_size_ == 0) {
+		return 0;
+	}
+
+	uint32_t bits = pending_[0] << 16;
+
+	if (pending_size_ == 2) {
+		bits |= pending_[1] << 8;
+	}
+
+	encode_group(bits, output);
+
+	output[2] = pending_size_ == 2 ? output[2] : '=';
+	output[3] = '=';
+
+	pending_size_ = 0;
+
+	return 4;
+}
+
+std::pair<size_t, bool> base64_decoder::update(const char* input, size_t size, uint8_t* output) {
+
+	size_t written = 0;
+	size_t i = 0;
+
+	while (i < size && state_ == state::data) {
+
+		// The vector code only starts on group boundaries, it stops on whitespaces, padding and errors
+#if defined(CPU_X86)
+		if (values_ == 0 && cpu_simd_level() != simd_level::scalar) {
+			size_t consumed = cpu_simd_level() == simd_level::avx2 ? decode_avx2(input + i, size - i, output + written)
+				: decode_ssse3(input + i, size - i, output + written);
+
+			i += consumed;
+			written += consumed / 4 * 3;
+
+			if (i == size) {
+				break;
+			}
+		}
+#endif
+
+		uint8_t value = decoding.values[static_cast<uint8_t>(input[i++])];
+
+		if (value < 64) {
+			bits_ = (bits_ << 6) | value;
+
+			if (++values_ == 4) {
+				output[written++] = static_cast<uint8_t>(bits_ >> 16);
+				output[written++] = static_cast<uint8_t>(bits_ >> 8);
+				output[written++] = static_cast<uint8_t>(bits_);
+				bits_ = 0;
+				values_ = 0;
+			}
+		}
+		else if (value == padding) {
+
+			// A group can end with 2 or 3 values, the padding is then "==" or "="
+			if (values_ < 2) {
+				state_ = state::failed;
+				break;
+			}
+
+			missing_paddings_ = values_ == 2 ? 1 : 0;
+			written += write_partial_group(output + written);
+			state_ = state::padding;
+		}
+		else if (value != whitespace) {
+			state_ = state::failed;
+			break;
+		}
+	}
+
+	// After the padding only whitespaces and the rest of the padding can follow
+	for (; i < size && state_ == state::padding; ++i) {
+		uint8_t value = decoding.values[static_cast<uint8_t>(input[i])];
+
+		if (value == padding && missing_paddings_ > 0) {
+			missing_paddings_--;
+		}
+		else if (value != whitespace) {
+			state_ = state::failed;
+		}
+	}
+
+	return std::pair<size_t, bool>(written, state_ != state::failed);
+}
+
+std::pair<size_t, bool> base64_decoder::finish(uint8_t* output) {
+
+	size_t written = 0;
+
+	if (state_ == state::data) {
+		// Without padding, the last group can still be partial
+		if (values_ == 1) {
+			state_ = state::failed;
+		}
+		else {
+			written = write_partial_group(output);
+		}
+	}
+	else if (state_ == state::padding && missing_paddings_ > 0) {
+		state_ = state::failed;
+	}
+
+	bool valid = state_ != state::failed;
+
+	*this = base64_decoder();
+
+	return std::pair<size_t, bool>(written, valid);
+}
+
+size_t base64_decoder::write_partial_group(uint8_t* output) {
+
+	size_t written = 0;
+
+	if (values_ == 2) {
+		output[written++] = static_cast<uint8_t>(bits_ >> 4);
+	}
+	else if (values_ == 3) {
+		output[written++] = static_cast<uint8_t>(bits_ >> 10);
+		output[written++] = static_cast<uint8_t>(bits_ >> 2);
+	}
+
+	bits_ = 0;
+	values_ = 0;
+
+	return written;
+}
+
+std::string base64_encode(const uint8_t* data, size_t size) {
+
+	std::string output(base64_encoder::max_encoded_size(size), '\0');
+
+	if (size == 0) {
+		return output;
+	}
+
+	base64_encoder encoder;
+
+	size_t written = encoder.update(data, size, &output[0]);
+	written += encoder.finish(&output[written]);
+
+	output.resize(written);
+
+	return output;
+}
+
+bool base64_decode(const char* input, size_t size, std::string& output) {
+
+	output.resize(base64_decoder::max_decoded_size(size));
+
+	uint8_t* out = reinterpret_cast<uint8_t*>(&output[0]);
+
+	base64_decoder decoder;
+
+	auto decoded = decoder.update(input, size, out);
+	auto last = decoder.finish(out + decoded.first);
+
+	output.resize(decoded.first + last.first);
+
+	return decoded.second && last.second;
+}
+
+std::string base64_decode(const std::string& input) {
+
+	std::string decoded;
+
+	if (!base64_decode(input.data(), input.size(), decoded)) {
+		return std::string();
+	}
+
+	return decoded;
+}
+
+// Data is moved in chunks of this size, so the memory used does not depend on the stream length
+static constexpr size_t stream_chunk_size = 1 << 16;
+
+bool base64_encode(std::istream& input, std::ostream& output) {
+
+	std::vector<uint8_t> chunk(stream_chunk_size);
+	std::vector<char> encoded(base64_encoder::max_encoded_size(stream_chunk_size));
+
+	base64_encoder encoder;
+
+	while (input.read(reinterpret_cast<char*>(chunk.data()), chunk.size()) || input.gcount() > 0) {
+		size_t written = encoder.update(chunk.data(), static_cast<size_t>(input.gcount()), encoded.data());
+		output.write(encoded.data(), written);
+	}
+
+	size_t written = encoder.finish(encoded.data());
+	output.write(encoded.data(), written);
+
+	return !input.bad() && static_cast<bool>(output);
+}
+
+bool base64_decode(std::istream& input, std::ostream& output) {
+
+	std::vector<char> chunk(stream_chunk_size);
+	std::vector<uint8_t> decoded(base64_decoder::max_decoded_size(stream_chunk_size));
+
+	base64_decoder decoder;
+
+	while (input.read(chunk.data(), chunk.size()) || input.gcount() > 0) {
+		auto result = decoder.update(chunk.data(), static_cast<size_t>(input.gcount()), decoded.data());
+
+		if (!result.second) {
+			return false;
+		}
+
+		output.write(reinterpret_cast<const char*>(decoded.data()), result.first);
+	}
+
+	auto result = decoder.finish(decoded.data());
+	output.write(reinterpret_cast<const char*>(decoded.data()), result.first);
+
+	return result.second && !input.bad() && static_cast<bool>(output);
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <istream>
+#include <ostream>
+
+// Encodes data given in chunks of any size, keeping at most 2 bytes between the calls
+class base64_encoder {
+	uint8_t pending_[3] = {};
+	size_t pending_size_ = 0;
+
+public:
+	// Characters written by update() for size bytes at most. finish() writes at most 4 characters.
+	static size_t max_encoded_size(size_t size) {
+		return (size + 2) / 3 * 4;
+	}
+
+	// Returns the number of characters written to output
+	size_t update(const uint8_t* data, size_t size, char* output);
+
+	// Writes the last group, padded with '='
+	size_t finish(char* output);
+};
+
+// Decodes characters given in chunks of any size, keeping at most 3 values between the calls.
+// Whitespaces are skipped and the final padding is optional. Any other character outside the alphabet is an error.
+class base64_decoder {
+	enum class state { data, padding, failed };
+
+	uint32_t bits_ = 0;
+	int values_ = 0;
+	int missing_paddings_ = 0;
+	state state_ = state::data;
+
+	size_t write_partial_group(uint8_t* output);
+
+public:
+	// Space needed in the output of update() for size characters, the vector code stores up to 32 bytes at a time.
+	// finish() writes at most 2 bytes.
+	static size_t max_decoded_size(size_t size) {
+		return size / 4 * 3 + 3 + 32;
+	}
+
+	// Returns the number of bytes written to output, false if the input is not valid
+	std::pair<size_t, bool> update(const char* input, size_t size, uint8_t* output);
+
+	// Writes what is left of an unpadded last group and resets the decoder, false if the input was not valid
+	std::pair<size_t, bool> finish(uint8_t* output);
+};
+
+// Encodes size bytes, padding the last group with '='
+std::string base64_encode(const uint8_t* data, size_t size);
+
+// Decodes the input into output, skipping whitespaces. The final padding is optional.
+// Returns false if the input contains any other character outside the alphabet, or is malformed.
+bool base64_decode(const char* input, size_t size, std::string& output);
+
+// Returns an empty string if the input is not valid
+std::string base64_decode(const std::string& input);
+
+// Stream adapters, they only keep a fixed size chunk in memory
+bool base64_encode(std::istream& input, std::ostream& output);
+bool base64_decode(std::istream& input, std::ostream& output);
@@ -0,0 +1,70 @@
+#pragma once
+
+// Run time detection of the x86 vector extensions, shared by the code with SSSE3 and AVX2 kernels.
+// CPU_X86 is defined when compiling for x86, and CPU_TARGET(isa) marks the functions that use an extension:
+// GCC and Clang only generate its instructions inside functions marked for it, MSVC always does.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(CPU_X86) && (defined(__GNUC__) || defined(__clang__))
+#define CPU_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CPU_TARGET(isa)
+#endif
+
+namespace cpu_features {
+
+struct features {
+	bool ssse3 = false;
+	bool avx2 = false;
+};
+
+inline features detect() {
+
+	features found;
+
+#if defined(CPU_X86) && defined(_MSC_VER)
+	int info[4];
+
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	found.ssse3 = (info[2] & (1 << 9)) != 0;
+
+	// AVX also needs the OS to save the YMM registers
+	bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+
+	if (avx && max_leaf >= 7) {
+		__cpuidex(info, 7, 0);
+		found.avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#elif defined(CPU_X86)
+	__builtin_cpu_init();
+	found.ssse3 = __builtin_cpu_supports("ssse3");
+	found.avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+	return found;
+}
+
+// Detected once, on the first call
+inline const features& cpu() {
+	static const features detected = detect();
+	return detected;
+}
+
+inline bool has_ssse3() {
+	return cpu().ssse3;
+}
+
+inline bool has_avx2() {
+	return cpu().avx2;
+}
+
+} // namespace cpu_features
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <utility>
+
+// Fast decoding of canonical Huffman codes, shared by the Huffman tools: a bit reader that keeps a 64 bit word
+// ready, a canonical decoding table and a buffered byte writer for the decoded symbols.
+namespace decoding {
+
+// Reads the stream in large blocks and keeps up to 64 bits ready, so that several codes can be decoded per refill
+class word_bit_reader {
+private:
+	std::istream& input_;
+	std::vector<uint8_t> block_;
+	size_t block_position_ = 0;
+	size_t block_size_ = 0;
+	bool input_finished_ = false;
+
+	uint64_t buffer_ = 0; // MSB aligned
+	uint32_t bits_in_buffer_ = 0;
+
+	void fill_block() {
+		size_t remaining = block_size_ - block_position_;
+		std::memmove(block_.data(), block_.data() + block_position_, remaining);
+
+		input_.read(reinterpret_cast<char*>(block_.data() + remaining), block_.size() - remaining);
+
+		block_size_ = remaining + static_cast<size_t>(input_.gcount());
+		block_position_ = 0;
+		input_finished_ = !input_;
+	}
+
+public:
+	word_bit_reader(std::istream& input, std::pair<uint8_t, uint8_t> pending_bits, size_t block_size = 1 << 20)
+		: input_(input), block_(block_size) {
+
+		if (pending_bits.second > 0) {
+			buffer_ = static_cast<uint64_t>(pending_bits.first) << (64 - pending_bits.second);
+			bits_in_buffer_ = pending_bits.second;
+		}
+	}
+
+	// After a refill at least 56 bits are available, unless the stream is over
+	void refill() {
+
+		if (block_size_ - block_position_ < 8 && !input_finished_) {
+			fill_block();
+		}
+
+		if (block_size_ - block_position_ >= 8) {
+			uint64_t word = 0;
+
+			for (int i = 0; i < 8; ++i) {
+				word = (word << 8) | block_[block_position_ + i];
+			}
+
+			buffer_ |= word >> bits_in_buffer_;
+			block_position_ += (63 - bits_in_buffer_) >> 3;
+			bits_in_buffer_ |= 56;
+		}
+		else {
+			while (bits_in_buffer_ <= 56 && block_position_ < block_size_) {
+				buffer_ |= static_cast<uint64_t>(block_[block_position_++]) << (56 - bits_in_buffer_);
+				bits_in_buffer_ += 8;
+			}
+		}
+	}
+
+	uint32_t available() const {
+		return bits_in_buffer_;
+	}
+
+	// Missing bits at the end of the stream are read as zeros
+	uint64_t peek(uint32_t number_of_bits) const {
+		return buffer_ >> (64 - number_of_bits);
+	}
+
+	void consume(uint32_t number_of_bits) {
+		buffer_ <<= number_of_bits;
+		bits_in_buffer_ -= number_of_bits;
+	}
+};
+
+class block_writer {
+private:
+	std::ostream& output_;
+	std::vector<uint8_t> block_;
+	size_t size_ = 0;
+
+public:
+	block_writer(std::ostream& output, size_t block_size = 1 << 20) : output_(output), block_(block_size) {}
+
+	void write(uint8_t value) {
+		block_[size_++] = value;
+
+		if (size_ == block_.size()) {
+			flush();
+		}
+	}
+
+	void flush() {
+		output_.write(reinterpret_cast<char*>(block_.data()), size_);
+		size_ = 0;
+	}
+
+	~block_writer() {
+		flush();
+	}
+};
+
+// Canonical decoding table: codes up to lookup_bits long are resolved with a single lookup,
+// longer ones through the first code of each length
+template<typename Symbol>
+class huffman_decode_table {
+private:
+	static constexpr uint32_t max_lookup_bits = 11;
+	static constexpr uint32_t max_code_length = 32;
+
+	struct entry {
+		Symbol symbol = 0;
+		uint8_t length = 0; // 0 means that the code is longer than lookup_bits_
+	};
+
+	uint32_t lookup_bits_ = 0;
+	uint32_t max_length_ = 0;
+	std::vector<entry> lookup_;
+
+	std::array<uint64_t, max_code_length + 1> first_code_{};
+	std::array<uint32_t, max_code_length + 1> count_{};
+	std::array<uint32_t, max_code_length + 1> first_index_{};
+	std::vector<Symbol> symbols_;
+
+public:
+
+	template<typename SortedSymbols>
+	bool build(const SortedSymbols& sorted_symbols) {
+
+		if (sorted_symbols.empty()) {
+			return false;
+		}
+
+		max_length_ = static_cast<uint32_t>(sorted_symbols.back().get().code_length);
+
+		if (max_length_ > max_code_length) {
+			return false;
+		}
+
+		lookup_bits_ = std::min(max_length_, max_lookup_bits);
+		lookup_.assign(size_t(1) << lookup_bits_, entry());
+
+		for (const auto& symbol_ref : sorted_symbols) {
+
+			const auto& symbol = symbol_ref.get();
+			uint32_t length = static_cast<uint32_t>(symbol.code_length);
+
+			// with canonical codes an oversubscribed length list overflows the last codes
+			if (length > 0 && (symbol.code >> length) != 0) {
+				return false;
+			}
+
+			if (count_[length] == 0) {
+				first_code_[length] = symbol.code;
+				first_index_[length] = static_cast<uint32_t>(symbols_.size());
+			}
+
+			count_[length]++;
+			symbols_.push_back(symbol.symbol);
+
+			if (length <= lookup_bits_) {
+				uint64_t first = symbol.code << (lookup_bits_ - length);
+				uint64_t last = first + (uint64_t(1) << (lookup_bits_ - length));
+
+				for (uint64_t i = first; i < last; ++i) {
+					lookup_[i] = { symbol.symbol, static_cast<uint8_t>(length) };
+				}
+			}
+		}
+
+		return true;
+	}
+
+	// From the code length of every symbol (0 for the missing ones), the symbol being the index. The codes are
+	// assigned ordering by length, then by symbol, without sorting: the symbols are counted per length and
+	// placed in increasing order.
+	template<typename Lengths>
+	bool build_from_lengths(const Lengths& lengths) {
+
+		for (const auto& length : lengths) {
+
+			if (length > max_code_length) {
+				return false;
+			}
+
+			count_[length]++;
+			max_length_ = std::max(max_length_, static_cast<uint32_t>(length));
+		}
+
+		count_[0] = 0;
+
+		if (max_length_ == 0) {
+			return false;
+		}
+
+		uint64_t code = 0;
+		uint32_t index = 0;
+
+		for (uint32_t length = 1; length <= max_length_; ++length) {
+			code = (code + count_[length - 1]) << 1;
+			first_code_[length] = code;
+			first_index_[length] = index;
+			index += count_[length];
+
+			// with canonical codes an oversubscribed length list overflows the last codes
+			if (code + count_[length] > (uint64_t(1) << length)) {
+				return false;
+			}
+		}
+
+		symbols_.resize(index);
+
+		std::array<uint32_t, max_code_length + 1> placed{};
+
+		lookup_bits_ = std::min(max_length_, max_lookup_bits);
+		lookup_.assign(size_t(1) << lookup_bits_, entry());
+
+		for (size_t symbol = 0; symbol < lengths.size(); ++symbol) {
+
+			uint32_t length = static_cast<uint32_t>(lengths[symbol]);
+
+			if (length == 0) {
+				continue;
+			}
+
+			uint32_t position = placed[length]++;
+			symbols_[first_index_[length] + position] = static_cast<Symbol>(symbol);
+
+			if (length <= lookup_bits_) {
+				uint64_t first = (first_code_[length] + position) << (lookup_bits_ - length);
+				uint64_t last = first + (uint64_t(1) << (lookup_bits_ - length));
+
+				for (uint64_t i = first; i < last; ++i) {
+					lookup_[i] = { static_cast<Symbol>(symbol), static_cast<uint8_t>(length) };
+				}
+			}
+		}
+
+		return true;
+	}
+
+	// Decodes from a stream that can only be read a bit at a time: read_bit() returns the next bit of the code,
+	// from the most significant. Returns the symbol and its code length, which is 0 if the bits are not a valid code.
+	template<typename ReadBit>
+	std::pair<Symbol, uint32_t> decode_bits(ReadBit read_bit) const {
+
+		uint64_t code = 0;
+
+		for (uint32_t length = 1; length <= max_length_; ++length) {
+
+			code = (code << 1) | read_bit();
+
+			if (code - first_code_[length] < count_[length]) {
+				return std::pair<Symbol, uint32_t>(symbols_[first_index_[length] + (code - first_code_[length])], length);
+			}
+		}
+
+		return std::pair<Symbol, uint32_t>(0, 0);
+	}
+
+	uint32_t max_length() const {
+		return max_length_;
+	}
+
+	// Returns the symbol and its code length, which is 0 if the bits are not a valid code
+	std::pair<Symbol, uint32_t> decode(const word_bit_reader& reader) const {
+
+		const entry& item = lookup_[reader.peek(lookup_bits_)];
+
+		if (item.length != 0) {
+			return std::pair<Symbol, uint32_t>(item.symbol, item.length);
+		}
+
+		uint64_t bits = reader.peek(max_length_);
+
+		for (uint32_t length = lookup_bits_ + 1; length <= max_length_; ++length) {
+
+			uint64_t code = bits >> (max_length_ - length);
+
+			if (code - first_code_[length] < count_[length]) {
+				return std::pair<Symbol, uint32_t>(symbols_[first_index_[length] + (code - first_code_[length])], length);
+			}
+		}
+
+		return std::pair<Symbol, uint32_t>(0, 0);
+	}
+};
+
+} // namespace decoding
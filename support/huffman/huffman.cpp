@@ -7,6 +7,10 @@
 #include <vector>
 #include <optional>
 #include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "decoding.h"
 
 template<typename T>
 std::pair<T, bool> raw_read(std::istream& input) {
@@ -67,6 +71,12 @@ public:
 
 		return std::pair<uint64_t, bool>(value, true);
 	}
+
+	// Bits already taken from the stream but not consumed yet, aligned to the right
+	std::pair<uint8_t, uint8_t> pending_bits() const {
+		uint8_t mask = static_cast<uint8_t>((1u << bits_in_buffer_) - 1);
+		return std::pair<uint8_t, uint8_t>(buffer_ & mask, bits_in_buffer_);
+	}
 };
 
 class bit_writer {
@@ -386,39 +396,56 @@ static bool decode_data(std::string input_file, std::string output_file) {
 		return false;
 	}
 
-	for (uint64_t i = 0; i < number_of_symbols.first; ++i) {
+	decoding::block_writer writer(output);
 
-		uint64_t code = 0;
-		uint64_t bits_in_code = 0;
+	uint64_t remaining_symbols = number_of_symbols.first;
+
+	// A single symbol gets a zero length code, nothing else has been written
+	if (sorted_symbols.size() == 1 && sorted_symbols.front().get().code_length == 0) {
+		for (; remaining_symbols > 0; --remaining_symbols) {
+			writer.write(sorted_symbols.front().get().symbol);
+		}
+
+		return true;
+	}
 
-		bool found = false;
+	decoding::huffman_decode_table<uint8_t> table;
 
-		for (const auto& symbol_ref : sorted_symbols) {
+	if (!table.build(sorted_symbols)) {
+		return false;
+	}
 
-			const auto& symbol = symbol_ref.get();
+	decoding::word_bit_reader reader(input, bit_reader.pending_bits());
 
-			while (bits_in_code < symbol.code_length) {
+	while (remaining_symbols > 0) {
 
-				auto bit = bit_reader.read_bit();
+		reader.refill();
 
-				if (!bit.second) {
-					return false;
-				}
+		// Close to the end of the stream the last codes may be shorter than the longest one
+		if (reader.available() < table.max_length()) {
+			auto decoded = table.decode(reader);
 
-				code <<= 1;
-				code |= static_cast<uint64_t>(bit.first);
-				bits_in_code++;
+			if (decoded.second == 0 || decoded.second > reader.available()) {
+				return false;
 			}
 
-			if (code == symbol.code) {
-				raw_write<uint8_t>(output, symbol.symbol);
-				found = true;
-				break;
-			}
+			reader.consume(decoded.second);
+			writer.write(decoded.first);
+			remaining_symbols--;
+			continue;
 		}
 
-		if (!found) {
-			return false;
+		// Decode as many codes as the buffer surely holds before refilling
+		while (remaining_symbols > 0 && reader.available() >= table.max_length()) {
+			auto decoded = table.decode(reader);
+
+			if (decoded.second == 0) {
+				return false;
+			}
+
+			reader.consume(decoded.second);
+			writer.write(decoded.first);
+			remaining_symbols--;
 		}
 	}
 
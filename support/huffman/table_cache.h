@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+
+namespace decoding {
+
+struct cache_statistics {
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t evictions = 0;
+	size_t entries = 0;
+};
+
+// A single line, for the tools that report their cache on request
+inline std::ostream& operator<<(std::ostream& output, const cache_statistics& statistics) {
+	return output << statistics.hits << " hits, " << statistics.misses << " misses, " << statistics.evictions <<
+		" evictions, " << statistics.entries << " entries";
+}
+
+// LRU cache of decoding tables indexed by what they are built from, usually the code lengths, a container of
+// integers. The same lengths recur across blocks and images, so each table is built once and then shared
+// through shared_ptr by any number of decoders: the tables are immutable once built.
+template<typename Key, typename Table>
+class table_cache {
+private:
+	struct key_hash {
+		size_t operator()(const Key& key) const {
+			// FNV-1a
+			uint64_t hash = 14695981039346656037ull;
+
+			for (const auto& item : key) {
+				hash ^= static_cast<uint64_t>(item);
+				hash *= 1099511628211ull;
+			}
+
+			return static_cast<size_t>(hash);
+		}
+	};
+
+	using cache_entry = std::pair<Key, std::shared_ptr<const Table>>;
+
+	size_t capacity_;
+	std::list<cache_entry> entries_; // most recently used first
+	std::unordered_map<Key, typename std::list<cache_entry>::iterator, key_hash> index_;
+	cache_statistics statistics_;
+	mutable std::mutex mutex_;
+
+public:
+	explicit table_cache(size_t capacity) : capacity_(capacity) {}
+
+	// On a miss the table is build(key), a shared_ptr to the new table or nullptr if the key doesn't describe
+	// one. nullptr is returned and not cached.
+	template<typename Builder>
+	std::shared_ptr<const Table> get(const Key& key, Builder build) {
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			auto it = index_.find(key);
+
+			if (it != index_.end()) {
+				entries_.splice(entries_.begin(), entries_, it->second);
+				statistics_.hits++;
+				return it->second->second;
+			}
+
+			statistics_.misses++;
+		}
+
+		// Build outside the lock, other threads can keep reading the cache meanwhile
+		std::shared_ptr<const Table> table = build(key);
+
+		if (!table) {
+			return nullptr;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		// Another thread could have built the same table in the meantime
+		auto it = index_.find(key);
+
+		if (it != index_.end()) {
+			entries_.splice(entries_.begin(), entries_, it->second);
+			return it->second->second;
+		}
+
+		entries_.emplace_front(key, table);
+		index_[key] = entries_.begin();
+
+		if (entries_.size() > capacity_) {
+			index_.erase(entries_.back().first);
+			entries_.pop_back();
+			statistics_.evictions++;
+		}
+
+		return table;
+	}
+
+	cache_statistics stats() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		cache_statistics current = statistics_;
+		current.entries = entries_.size();
+
+		return current;
+	}
+};
+
+} // namespace decoding
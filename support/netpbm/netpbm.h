@@ -0,0 +1,798 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <istream>
+#include <ostream>
+#include <fstream>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <limits>
+#include <initializer_list>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NETPBM_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define NETPBM_AVX2
+#include <immintrin.h>
+#endif
+
+// Binary Netpbm images: PGM (P5), PPM (P6) and PAM (P7), shared by the tools that read or write them.
+// Samples are stored row by row, depth samples for each pixel. They take one byte if the maximum value is
+// below 256, two bytes otherwise: big endian in the files, native order in memory.
+namespace netpbm {
+
+enum class format : char {
+	pgm = '5',
+	ppm = '6',
+	pam = '7'
+};
+
+struct header {
+	netpbm::format format = netpbm::format::pam;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t depth = 0;
+	uint32_t max_value = 0;
+	std::string tuple_type;
+
+	size_t sample_size() const {
+		return max_value > 255 ? 2 : 1;
+	}
+
+	size_t row_size() const {
+		return static_cast<size_t>(width) * depth * sample_size();
+	}
+
+	size_t data_size() const {
+		return row_size() * height;
+	}
+};
+
+inline header pgm_header(uint32_t width, uint32_t height, uint32_t max_value = 255) {
+	header info;
+	info.format = format::pgm;
+	info.width = width;
+	info.height = height;
+	info.depth = 1;
+	info.max_value = max_value;
+	return info;
+}
+
+inline header ppm_header(uint32_t width, uint32_t height, uint32_t max_value = 255) {
+	header info = pgm_header(width, height, max_value);
+	info.format = format::ppm;
+	info.depth = 3;
+	return info;
+}
+
+inline header pam_header(uint32_t width, uint32_t height, uint32_t depth, uint32_t max_value, const std::string& tuple_type) {
+	header info = pgm_header(width, height, max_value);
+	info.format = format::pam;
+	info.depth = depth;
+	info.tuple_type = tuple_type;
+	return info;
+}
+
+namespace detail {
+
+// The header parser reads from memory or from a stream buffer, get() and peek() return -1 at the end
+class memory_source {
+	const uint8_t* data_;
+	size_t size_;
+	size_t position_ = 0;
+
+public:
+	memory_source(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+	int get() {
+		return position_ < size_ ? data_[position_++] : -1;
+	}
+
+	int peek() const {
+		return position_ < size_ ? data_[position_] : -1;
+	}
+
+	size_t position() const {
+		return position_;
+	}
+};
+
+class stream_source {
+	std::streambuf& buffer_;
+
+public:
+	explicit stream_source(std::streambuf& buffer) : buffer_(buffer) {}
+
+	int get() {
+		auto c = buffer_.sbumpc();
+		return c == std::char_traits<char>::eof() ? -1 : c;
+	}
+
+	int peek() {
+		auto c = buffer_.sgetc();
+		return c == std::char_traits<char>::eof() ? -1 : c;
+	}
+};
+
+inline bool is_space(int c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Longest keyword or value accepted in a PAM header line
+static const size_t max_token_size = 1024;
+
+template<typename Source>
+void skip_line(Source& source) {
+	for (int c = source.get(); c != -1 && c != '\n'; c = source.get()) {}
+}
+
+// Whitespaces and comments, a comment goes from '#' to the end of the line
+template<typename Source>
+void skip_separators(Source& source) {
+
+	for (int c = source.peek(); c != -1; c = source.peek()) {
+
+		if (c == '#') {
+			skip_line(source);
+		}
+		else if (is_space(c)) {
+			source.get();
+		}
+		else {
+			return;
+		}
+	}
+}
+
+template<typename Source>
+bool read_number(Source& source, uint32_t& value) {
+
+	int c = source.peek();
+
+	if (c < '0' || c > '9') {
+		return false;
+	}
+
+	uint64_t number = 0;
+
+	do {
+		number = number * 10 + (c - '0');
+
+		if (number > std::numeric_limits<uint32_t>::max()) {
+			return false;
+		}
+
+		source.get();
+		c = source.peek();
+	} while (c >= '0' && c <= '9');
+
+	value = static_cast<uint32_t>(number);
+	return true;
+}
+
+inline bool parse_number(const std::string& text, uint32_t& value) {
+	memory_source source(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+	return read_number(source, value) && source.position() == text.size();
+}
+
+// Width, height and maximum value separated by whitespaces and comments, then a single whitespace before the samples
+template<typename Source>
+bool parse_pnm_header(Source& source, header& info) {
+
+	for (uint32_t* field : { &info.width, &info.height, &info.max_value }) {
+		skip_separators(source);
+
+		if (!read_number(source, *field)) {
+			return false;
+		}
+	}
+
+	return is_space(source.get());
+}
+
+// Lines with a keyword and its value, up to the ENDHDR line. Blank lines and comment lines are skipped.
+// Multiple TUPLTYPE lines are joined with a space.
+template<typename Source>
+bool parse_pam_header(Source& source, header& info) {
+
+	enum : unsigned { has_width = 1, has_height = 2, has_depth = 4, has_max_value = 8, has_all = 15 };
+
+	unsigned fields = 0;
+	std::string keyword;
+	std::string value;
+
+	for (;;) {
+		int c = source.peek();
+
+		while (is_space(c)) {
+			source.get();
+			c = source.peek();
+		}
+
+		if (c == -1) {
+			return false;
+		}
+
+		if (c == '#') {
+			skip_line(source);
+			continue;
+		}
+
+		keyword.clear();
+
+		for (; c != -1 && !is_space(c); c = source.peek()) {
+
+			if (keyword.size() == max_token_size) {
+				return false;
+			}
+
+			keyword.push_back(static_cast<char>(source.get()));
+		}
+
+		// The rest of the line without the surrounding whitespaces
+		value.clear();
+
+		for (c = source.get(); c != -1 && c != '\n'; c = source.get()) {
+
+			if (value.size() == max_token_size) {
+				return false;
+			}
+
+			value.push_back(static_cast<char>(c));
+		}
+
+		auto first = value.find_first_not_of(" \t\r\v\f");
+		value.erase(0, std::min(first, value.size()));
+		value.erase(value.find_last_not_of(" \t\r\v\f") + 1);
+
+		if (keyword == "ENDHDR") {
+			break;
+		}
+
+		if (keyword == "TUPLTYPE") {
+
+			if (!info.tuple_type.empty()) {
+				info.tuple_type += ' ';
+			}
+
+			info.tuple_type += value;
+			continue;
+		}
+
+		uint32_t* field = nullptr;
+		unsigned flag = 0;
+
+		if (keyword == "WIDTH") {
+			field = &info.width;
+			flag = has_width;
+		}
+		else if (keyword == "HEIGHT") {
+			field = &info.height;
+			flag = has_height;
+		}
+		else if (keyword == "DEPTH") {
+			field = &info.depth;
+			flag = has_depth;
+		}
+		else if (keyword == "MAXVAL") {
+			field = &info.max_value;
+			flag = has_max_value;
+		}
+		else {
+			return false;
+		}
+
+		if (!parse_number(value, *field)) {
+			return false;
+		}
+
+		fields |= flag;
+	}
+
+	return fields == has_all;
+}
+
+template<typename Source>
+bool parse_header(Source& source, header& info) {
+
+	info = header();
+
+	if (source.get() != 'P') {
+		return false;
+	}
+
+	bool parsed = false;
+
+	switch (source.get()) {
+	case '5':
+		info.format = format::pgm;
+		info.depth = 1;
+		parsed = parse_pnm_header(source, info);
+		break;
+	case '6':
+		info.format = format::ppm;
+		info.depth = 3;
+		parsed = parse_pnm_header(source, info);
+		break;
+	case '7':
+		info.format = format::pam;
+		parsed = is_space(source.get()) && parse_pam_header(source, info);
+		break;
+	default:
+		return false;
+	}
+
+	if (!parsed || info.width == 0 || info.height == 0 || info.depth == 0 || info.max_value == 0 || info.max_value > 65535) {
+		return false;
+	}
+
+	// The size of the samples must fit in memory
+	uint64_t row_samples = static_cast<uint64_t>(info.width) * info.depth;
+	return row_samples <= std::numeric_limits<size_t>::max() / info.sample_size() / info.height;
+}
+
+} // namespace detail
+
+// Reads the header, leaving the stream at the first sample
+inline std::pair<header, bool> read_header(std::istream& input) {
+
+	header info;
+
+	if (!input || input.rdbuf() == nullptr) {
+		return { info, false };
+	}
+
+	detail::stream_source source(*input.rdbuf());
+
+	if (!detail::parse_header(source, info)) {
+		input.setstate(std::ios::failbit);
+		return { info, false };
+	}
+
+	return { info, true };
+}
+
+// Parses the header at the beginning of size bytes, header_size is set to the offset of the first sample
+inline std::pair<header, bool> parse_header(const uint8_t* data, size_t size, size_t& header_size) {
+
+	header info;
+	detail::memory_source source(data, size);
+
+	if (!detail::parse_header(source, info)) {
+		return { info, false };
+	}
+
+	header_size = source.position();
+	return { info, true };
+}
+
+// Swaps the bytes of count 16-bit samples, between big endian and native order. input and output may be the same buffer.
+inline void swap_bytes16(const uint8_t* input, size_t count, uint8_t* output) {
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	std::memmove(output, input, count * 2);
+#else
+	size_t i = 0;
+
+#if defined(NETPBM_AVX2)
+	for (; i + 16 <= count; i += 16) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i * 2));
+		v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i * 2), v);
+	}
+#endif
+
+#if defined(NETPBM_SSE2)
+	for (; i + 8 <= count; i += 8) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i * 2));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output + i * 2), v);
+	}
+#endif
+
+	for (; i < count; ++i) {
+		uint8_t high = input[i * 2];
+		uint8_t low = input[i * 2 + 1];
+		output[i * 2] = low;
+		output[i * 2 + 1] = high;
+	}
+#endif
+}
+
+// Widens count 8-bit samples stored at the beginning of samples to 16 bits, in place
+inline void widen_samples(uint16_t* samples, size_t count) {
+
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(samples);
+
+	// Backwards, so that every byte is read before being overwritten
+	for (size_t i = count; i-- > 0;) {
+		samples[i] = bytes[i];
+	}
+}
+
+// Copies the samples as stored in a file to output, 16-bit samples in native order
+inline void copy_samples(const uint8_t* input, const header& info, void* output) {
+
+	size_t size = info.data_size();
+
+	if (info.sample_size() == 2) {
+		swap_bytes16(input, size / 2, static_cast<uint8_t*>(output));
+	}
+	else {
+		std::memcpy(output, input, size);
+	}
+}
+
+// Reads info.data_size() bytes of samples with a single read, 16-bit samples in native order
+inline bool read_samples(std::istream& input, const header& info, void* output) {
+
+	size_t size = info.data_size();
+
+	input.read(static_cast<char*>(output), static_cast<std::streamsize>(size));
+
+	if (static_cast<size_t>(input.gcount()) != size) {
+		return false;
+	}
+
+	if (info.sample_size() == 2) {
+		auto bytes = static_cast<uint8_t*>(output);
+		swap_bytes16(bytes, size / 2, bytes);
+	}
+
+	return true;
+}
+
+// Read only view of a whole file mapped in memory, is_open() is false if the file cannot be mapped
+class mapped_file {
+	const uint8_t* data_ = nullptr;
+	size_t size_ = 0;
+
+public:
+	explicit mapped_file(const std::string& filename) {
+
+#if defined(_WIN32)
+		HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+		if (file == INVALID_HANDLE_VALUE) {
+			return;
+		}
+
+		LARGE_INTEGER file_size;
+
+		if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0 &&
+			static_cast<uint64_t>(file_size.QuadPart) <= std::numeric_limits<size_t>::max()) {
+
+			HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+			// The view keeps the mapping alive after its handle is closed
+			if (mapping != nullptr) {
+				data_ = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+				size_ = data_ != nullptr ? static_cast<size_t>(file_size.QuadPart) : 0;
+				CloseHandle(mapping);
+			}
+		}
+
+		CloseHandle(file);
+#else
+		int fd = open(filename.c_str(), O_RDONLY);
+
+		if (fd < 0) {
+			return;
+		}
+
+		struct stat file_status;
+
+		if (fstat(fd, &file_status) == 0 && S_ISREG(file_status.st_mode) && file_status.st_size > 0 &&
+			static_cast<uint64_t>(file_status.st_size) <= std::numeric_limits<size_t>::max()) {
+
+			size_t size = static_cast<size_t>(file_status.st_size);
+			void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+			if (data != MAP_FAILED) {
+				madvise(data, size, MADV_SEQUENTIAL);
+				data_ = static_cast<const uint8_t*>(data);
+				size_ = size;
+			}
+		}
+
+		close(fd);
+#endif
+	}
+
+	~mapped_file() {
+
+		if (data_ == nullptr) {
+			return;
+		}
+
+#if defined(_WIN32)
+		UnmapViewOfFile(data_);
+#else
+		munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+	}
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	bool is_open() const {
+		return data_ != nullptr;
+	}
+
+	const uint8_t* data() const {
+		return data_;
+	}
+
+	size_t size() const {
+		return size_;
+	}
+};
+
+// Loads an image from a stream: the header, then the samples with a single read.
+// allocate(info) returns a buffer for info.data_size() bytes, or nullptr to refuse the image.
+template<typename Allocate>
+bool load(std::istream& input, header& info, Allocate allocate) {
+
+	auto result = read_header(input);
+
+	if (!result.second) {
+		return false;
+	}
+
+	info = result.first;
+	void* output = allocate(info);
+
+	return output != nullptr && read_samples(input, info, output);
+}
+
+// Loads an image from a file, mapping it in memory when possible so that the samples are copied only once
+template<typename Allocate>
+bool load(const std::string& filename, header& info, Allocate allocate) {
+
+	mapped_file file(filename);
+
+	if (!file.is_open()) {
+		std::ifstream input(filename, std::ios::binary);
+		return load(input, info, allocate);
+	}
+
+	size_t header_size = 0;
+	auto result = parse_header(file.data(), file.size(), header_size);
+
+	if (!result.second || file.size() - header_size < result.first.data_size()) {
+		return false;
+	}
+
+	info = result.first;
+	void* output = allocate(info);
+
+	if (output == nullptr) {
+		return false;
+	}
+
+	copy_samples(file.data() + header_size, info, output);
+	return true;
+}
+
+inline std::string format_header(const header& info) {
+
+	std::string text = "P";
+	text += static_cast<char>(info.format);
+	text += '\n';
+
+	if (info.format == format::pam) {
+		text += "WIDTH " + std::to_string(info.width) + "\n";
+		text += "HEIGHT " + std::to_string(info.height) + "\n";
+		text += "DEPTH " + std::to_string(info.depth) + "\n";
+		text += "MAXVAL " + std::to_string(info.max_value) + "\n";
+
+		if (!info.tuple_type.empty()) {
+			text += "TUPLTYPE " + info.tuple_type + "\n";
+		}
+
+		text += "ENDHDR\n";
+	}
+	else {
+		text += std::to_string(info.width) + " " + std::to_string(info.height) + "\n";
+		text += std::to_string(info.max_value) + "\n";
+	}
+
+	return text;
+}
+
+// 16-bit samples are converted to big endian in blocks of this size before being written
+static const size_t write_block_size = 1 << 20;
+
+// Writes info.data_size() bytes of samples, 8-bit samples with a single write.
+// block is the buffer for the conversion of 16-bit samples, kept between the calls.
+inline bool write_samples(std::ostream& output, const header& info, const void* samples, std::vector<uint8_t>& block) {
+
+	auto bytes = static_cast<const uint8_t*>(samples);
+	size_t size = info.data_size();
+
+	if (info.sample_size() == 1) {
+		output.write(reinterpret_cast<const char*>(bytes), static_cast<std::streamsize>(size));
+		return static_cast<bool>(output);
+	}
+
+	block.resize(std::min(size, write_block_size));
+
+	for (size_t offset = 0; offset < size && output; offset += block.size()) {
+		size_t block_size = std::min(block.size(), size - offset);
+		swap_bytes16(bytes + offset, block_size / 2, block.data());
+		output.write(reinterpret_cast<const char*>(block.data()), static_cast<std::streamsize>(block_size));
+	}
+
+	return static_cast<bool>(output);
+}
+
+inline bool write(std::ostream& output, const header& info, const void* samples) {
+
+	std::string text = format_header(info);
+	output.write(text.data(), text.size());
+
+	std::vector<uint8_t> block;
+	return write_samples(output, info, samples, block);
+}
+
+inline bool write(const std::string& filename, const header& info, const void* samples) {
+
+	std::ofstream output(filename, std::ios::binary);
+
+	if (!output || !write(output, info, samples)) {
+		return false;
+	}
+
+	output.close();
+	return static_cast<bool>(output);
+}
+
+// Reads an image a block of rows at a time, so that only the rows being processed are in memory
+class row_reader {
+	std::ifstream file_;
+	std::istream& input_;
+	header info_;
+	uint32_t next_row_ = 0;
+	bool good_ = false;
+
+	void read_header() {
+		auto result = netpbm::read_header(input_);
+		info_ = result.first;
+		good_ = result.second;
+	}
+
+public:
+	explicit row_reader(std::istream& input) : input_(input) {
+		read_header();
+	}
+
+	explicit row_reader(const std::string& filename) : file_(filename, std::ios::binary), input_(file_) {
+		read_header();
+	}
+
+	row_reader(const row_reader&) = delete;
+	row_reader& operator=(const row_reader&) = delete;
+
+	// False if the header is not valid or a read failed
+	bool good() const {
+		return good_;
+	}
+
+	const header& info() const {
+		return info_;
+	}
+
+	uint32_t rows_left() const {
+		return info_.height - next_row_;
+	}
+
+	// Reads up to count rows into output, which has room for count * info().row_size() bytes.
+	// Returns the number of rows read, 0 at the end of the image or on errors.
+	uint32_t read_rows(void* output, uint32_t count) {
+
+		count = std::min(count, rows_left());
+
+		if (!good_ || count == 0) {
+			return 0;
+		}
+
+		header rows_info = info_;
+		rows_info.height = count;
+
+		if (!read_samples(input_, rows_info, output)) {
+			good_ = false;
+			return 0;
+		}
+
+		next_row_ += count;
+		return count;
+	}
+
+	// Reads up to count rows into buffer, resized to hold exactly them, so that it can be reused for every block
+	template<typename T>
+	uint32_t read_rows(std::vector<T>& buffer, uint32_t count) {
+		count = std::min(count, rows_left());
+		buffer.resize((static_cast<size_t>(count) * info_.row_size() + sizeof(T) - 1) / sizeof(T));
+		return read_rows(buffer.data(), count);
+	}
+};
+
+// Writes an image a block of rows at a time, the header is written on construction
+class row_writer {
+	std::ofstream file_;
+	std::ostream& output_;
+	header info_;
+	uint32_t next_row_ = 0;
+	std::vector<uint8_t> block_;
+
+	void write_header() {
+		std::string text = format_header(info_);
+		output_.write(text.data(), text.size());
+	}
+
+public:
+	row_writer(std::ostream& output, const header& info) : output_(output), info_(info) {
+		write_header();
+	}
+
+	row_writer(const std::string& filename, const header& info) : file_(filename, std::ios::binary), output_(file_), info_(info) {
+		write_header();
+	}
+
+	row_writer(const row_writer&) = delete;
+	row_writer& operator=(const row_writer&) = delete;
+
+	bool good() const {
+		return static_cast<bool>(output_);
+	}
+
+	const header& info() const {
+		return info_;
+	}
+
+	// Writes count rows of info().row_size() bytes each, no more than the rows left in the image
+	bool write_rows(const void* rows, uint32_t count) {
+
+		if (count > info_.height - next_row_) {
+			output_.setstate(std::ios::failbit);
+			return false;
+		}
+
+		header rows_info = info_;
+		rows_info.height = count;
+
+		next_row_ += count;
+		return write_samples(output_, rows_info, rows, block_);
+	}
+
+	// Flushes the output, false if any write failed or some rows are missing
+	bool finish() {
+		output_.flush();
+		return good() && next_row_ == info_.height;
+	}
+};
+
+} // namespace netpbm
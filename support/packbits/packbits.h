@@ -0,0 +1,264 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cstring>
+
+#include "../thread_pool/thread_pool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PACKBITS_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// PackBits encoding shared by the tools that export image planes. The commands are written without the EOD,
+// so that consecutive spans or rows concatenate to a single stream.
+namespace packbits {
+
+namespace detail {
+
+inline uint32_t count_trailing_zeros(uint32_t value) {
+#if defined(_MSC_VER)
+	unsigned long index = 0;
+	_BitScanForward(&index, value);
+	return index;
+#else
+	return __builtin_ctz(value);
+#endif
+}
+
+// Length of the run of data[0] starting at data, up to size bytes
+inline size_t find_run_end(const uint8_t* data, size_t size) {
+
+	size_t i = 1;
+
+#ifdef PACKBITS_SSE2
+	const __m128i value = _mm_set1_epi8(static_cast<char>(data[0]));
+
+	while (i + 16 <= size) {
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		uint32_t different = ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, value))) & 0xFFFF;
+
+		if (different != 0) {
+			return i + count_trailing_zeros(different);
+		}
+
+		i += 16;
+	}
+#endif
+
+	while (i < size && data[i] == data[0]) {
+		i++;
+	}
+
+	return i;
+}
+
+// Position of the first pair of equal adjacent bytes (the start of a run), size if there is none
+inline size_t find_run_start(const uint8_t* data, size_t size) {
+
+	size_t i = 0;
+
+#ifdef PACKBITS_SSE2
+	while (i + 17 <= size) {
+		__m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		__m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 1));
+		uint32_t equal = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(current, next)));
+
+		if (equal != 0) {
+			return i + count_trailing_zeros(equal);
+		}
+
+		i += 16;
+	}
+#endif
+
+	while (i + 1 < size) {
+		if (data[i] == data[i + 1]) {
+			return i;
+		}
+
+		i++;
+	}
+
+	return size;
+}
+
+inline uint8_t* write_copy(const uint8_t* data, size_t size, uint8_t* output) {
+
+	// Only up to 128 bytes for each copy
+	while (size > 0) {
+		size_t bytes = std::min<size_t>(size, 128);
+
+		// COPY is 0 based
+		*output++ = static_cast<uint8_t>(bytes - 1);
+		std::memcpy(output, data, bytes);
+
+		output += bytes;
+		data += bytes;
+		size -= bytes;
+	}
+
+	return output;
+}
+
+inline uint8_t* write_run(uint8_t value, size_t size, uint8_t* output) {
+	*output++ = static_cast<uint8_t>(257 - size);
+	*output++ = value;
+	return output;
+}
+
+} // namespace detail
+
+// Worst case: a single byte copy between each pair of 2 bytes runs (4 bytes every 3),
+// plus one extra byte every 128 copied bytes
+inline size_t max_encoded_size(size_t size) {
+	return size + (size + 2) / 3 + (size + 127) / 128;
+}
+
+// Encodes size bytes into output, which must hold max_encoded_size(size) bytes, without the EOD. Returns the
+// encoded size. Runs of at least 2 equal bytes are written as runs, everything else is copied, both in blocks of
+// up to 128.
+inline size_t encode(const uint8_t* data, size_t size, uint8_t* output) {
+
+	uint8_t* output_begin = output;
+
+	size_t copy_begin = 0;
+	size_t i = 0;
+
+	while (i < size) {
+
+		size_t run_begin = i + detail::find_run_start(data + i, size - i);
+
+		if (run_begin == size) {
+			break;
+		}
+
+		size_t run_length = detail::find_run_end(data + run_begin, size - run_begin);
+
+		output = detail::write_copy(data + copy_begin, run_begin - copy_begin, output);
+
+		for (size_t full_runs = run_length / 128; full_runs > 0; --full_runs) {
+			output = detail::write_run(data[run_begin], 128, output);
+		}
+
+		size_t remainder = run_length % 128;
+
+		i = run_begin + run_length;
+		copy_begin = i;
+
+		if (remainder >= 2) {
+			output = detail::write_run(data[run_begin], remainder, output);
+		}
+		else if (remainder == 1) {
+			// A single byte left over from a long run goes with the next copy
+			copy_begin--;
+		}
+	}
+
+	output = detail::write_copy(data + copy_begin, size - copy_begin, output);
+
+	return output - output_begin;
+}
+
+// Appends the PackBits commands for size bytes to encoded, without the EOD
+inline void encode_span(const uint8_t* data, size_t size, std::vector<uint8_t>& encoded) {
+
+	size_t begin = encoded.size();
+
+	encoded.resize(begin + max_encoded_size(size));
+	encoded.resize(begin + encode(data, size, encoded.data() + begin));
+}
+
+// A plane of rows * cols bytes, the rows one after the other
+struct plane {
+	const uint8_t* data;
+	size_t rows;
+	size_t cols;
+};
+
+// Rows encoded independently (as in TIFF strips of one row), without the EOD.
+// Row r is in data[row_offsets[r], row_offsets[r + 1]) and decodes to exactly cols bytes. The offsets are 64 bit,
+// the encoding of a large plane can pass 4 GiB.
+struct encoded_rows {
+	std::vector<uint8_t> data;
+	std::vector<uint64_t> row_offsets;
+};
+
+// Encodes the rows of count planes at once: blocks of rows of all the planes are the tasks of the pool, so the
+// planes are encoded concurrently and each of them in parallel
+inline void encode_rows(thread_pool& pool, const plane* planes, encoded_rows* encoded, size_t count) {
+
+	// Each block is encoded by a single task in its own buffer
+	static constexpr size_t rows_per_block = 16;
+
+	struct encoded_block {
+		std::vector<uint8_t> data;
+		std::array<uint64_t, rows_per_block> row_sizes;
+	};
+
+	std::vector<std::vector<encoded_block>> blocks(count);
+	std::vector<std::pair<size_t, size_t>> tasks;
+
+	for (size_t index = 0; index < count; ++index) {
+		size_t blocks_count = (planes[index].rows + rows_per_block - 1) / rows_per_block;
+
+		blocks[index].resize(blocks_count);
+
+		for (size_t block = 0; block < blocks_count; ++block) {
+			tasks.emplace_back(index, block);
+		}
+	}
+
+	pool.run(tasks.size(), [&](size_t task) {
+		size_t index = tasks[task].first;
+		size_t block = tasks[task].second;
+
+		const plane& input = planes[index];
+		encoded_block& output = blocks[index][block];
+
+		size_t first_row = block * rows_per_block;
+		size_t last_row = std::min(first_row + rows_per_block, input.rows);
+
+		output.data.reserve((last_row - first_row) * max_encoded_size(input.cols));
+
+		for (size_t row = first_row; row < last_row; ++row) {
+			size_t row_begin = output.data.size();
+			encode_span(input.data + row * input.cols, input.cols, output.data);
+			output.row_sizes[row - first_row] = output.data.size() - row_begin;
+		}
+	});
+
+	for (size_t index = 0; index < count; ++index) {
+		encoded_rows& result = encoded[index];
+		size_t rows = planes[index].rows;
+
+		size_t total_size = 0;
+
+		for (const auto& block : blocks[index]) {
+			total_size += block.data.size();
+		}
+
+		result.data.clear();
+		result.data.reserve(total_size);
+		result.row_offsets.resize(rows + 1);
+		result.row_offsets[0] = 0;
+
+		for (size_t row = 0; row < rows; ++row) {
+			result.row_offsets[row + 1] = result.row_offsets[row] + blocks[index][row / rows_per_block].row_sizes[row % rows_per_block];
+		}
+
+		for (const auto& block : blocks[index]) {
+			result.data.insert(result.data.end(), block.data.begin(), block.data.end());
+		}
+	}
+}
+
+} // namespace packbits
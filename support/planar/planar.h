@@ -0,0 +1,267 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "../cpu_features/cpu_features.h"
+
+// Conversions between interleaved RGB pixels and separate R, G and B planes, shared by the tools that split
+// and merge channels. The vector code moves 16 (SSSE3) or 32 (AVX2) pixels at a time with byte shuffles,
+// the instruction set is chosen once at run time.
+namespace planar {
+
+namespace detail {
+
+enum class simd_level { scalar, ssse3, avx2 };
+
+inline simd_level cpu_simd_level() {
+	static const simd_level level = cpu_features::has_avx2() ? simd_level::avx2 :
+		cpu_features::has_ssse3() ? simd_level::ssse3 : simd_level::scalar;
+	return level;
+}
+
+#if defined(CPU_X86)
+
+// For each plane, the bytes it takes from each of three consecutive 16 byte blocks of pixels (-1 for none)
+alignas(16) static const int8_t split_masks[3][3][16] = {
+	{
+		{ 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1 },
+		{ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13 }
+	},
+	{
+		{ 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1 },
+		{ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14 }
+	},
+	{
+		{ 2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ -1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1 },
+		{ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15 }
+	}
+};
+
+// For each 16 byte block of pixels, the bytes it takes from each plane
+alignas(16) static const int8_t merge_masks[3][3][16] = {
+	{
+		{ 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5 },
+		{ -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1 },
+		{ -1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1 }
+	},
+	{
+		{ -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1 },
+		{ 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10 },
+		{ -1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1 }
+	},
+	{
+		{ -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1 },
+		{ -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1 },
+		{ 10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15 }
+	}
+};
+
+// Each function processes whole blocks of pixels and returns the number of pixels done
+
+CPU_TARGET("ssse3")
+inline __m128i shuffle3(__m128i a, __m128i b, __m128i c, const int8_t (&masks)[3][16]) {
+	__m128i result = _mm_shuffle_epi8(a, _mm_load_si128(reinterpret_cast<const __m128i*>(masks[0])));
+	result = _mm_or_si128(result, _mm_shuffle_epi8(b, _mm_load_si128(reinterpret_cast<const __m128i*>(masks[1]))));
+	return _mm_or_si128(result, _mm_shuffle_epi8(c, _mm_load_si128(reinterpret_cast<const __m128i*>(masks[2]))));
+}
+
+CPU_TARGET("ssse3")
+inline size_t extract_ssse3(const uint8_t* rgb, size_t count, int channel, uint8_t* plane) {
+
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		const __m128i* input = reinterpret_cast<const __m128i*>(rgb + i * 3);
+		__m128i a = _mm_loadu_si128(input);
+		__m128i b = _mm_loadu_si128(input + 1);
+		__m128i c = _mm_loadu_si128(input + 2);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(plane + i), shuffle3(a, b, c, split_masks[channel]));
+	}
+
+	return i;
+}
+
+CPU_TARGET("ssse3")
+inline size_t deinterleave_ssse3(const uint8_t* rgb, size_t count, uint8_t* r, uint8_t* g, uint8_t* b) {
+
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		const __m128i* input = reinterpret_cast<const __m128i*>(rgb + i * 3);
+		__m128i x = _mm_loadu_si128(input);
+		__m128i y = _mm_loadu_si128(input + 1);
+		__m128i z = _mm_loadu_si128(input + 2);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(r + i), shuffle3(x, y, z, split_masks[0]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(g + i), shuffle3(x, y, z, split_masks[1]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(b + i), shuffle3(x, y, z, split_masks[2]));
+	}
+
+	return i;
+}
+
+CPU_TARGET("ssse3")
+inline size_t interleave_ssse3(const uint8_t* r, const uint8_t* g, const uint8_t* b, size_t count, uint8_t* rgb) {
+
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i));
+		__m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + i));
+		__m128i z = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+		__m128i* output = reinterpret_cast<__m128i*>(rgb + i * 3);
+		_mm_storeu_si128(output, shuffle3(x, y, z, merge_masks[0]));
+		_mm_storeu_si128(output + 1, shuffle3(x, y, z, merge_masks[1]));
+		_mm_storeu_si128(output + 2, shuffle3(x, y, z, merge_masks[2]));
+	}
+
+	return i;
+}
+
+// The AVX2 shuffles work within 128 bit lanes: the low lanes hold the first 16 pixels and the high lanes
+// the next 16, so the same masks apply to both halves
+
+CPU_TARGET("avx2")
+inline __m256i load_mask(const int8_t (&mask)[16]) {
+	return _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(mask)));
+}
+
+CPU_TARGET("avx2")
+inline __m256i shuffle3(__m256i a, __m256i b, __m256i c, const int8_t (&masks)[3][16]) {
+	__m256i result = _mm256_shuffle_epi8(a, load_mask(masks[0]));
+	result = _mm256_or_si256(result, _mm256_shuffle_epi8(b, load_mask(masks[1])));
+	return _mm256_or_si256(result, _mm256_shuffle_epi8(c, load_mask(masks[2])));
+}
+
+// Reads 32 pixels as three vectors of 16 byte blocks: [0 3], [1 4] and [2 5]
+CPU_TARGET("avx2")
+inline void load_pixels_avx2(const uint8_t* rgb, __m256i& x, __m256i& y, __m256i& z) {
+	const __m256i* input = reinterpret_cast<const __m256i*>(rgb);
+	__m256i blocks01 = _mm256_loadu_si256(input);
+	__m256i blocks23 = _mm256_loadu_si256(input + 1);
+	__m256i blocks45 = _mm256_loadu_si256(input + 2);
+	x = _mm256_permute2x128_si256(blocks01, blocks23, 0x30);
+	y = _mm256_permute2x128_si256(blocks01, blocks45, 0x21);
+	z = _mm256_permute2x128_si256(blocks23, blocks45, 0x30);
+}
+
+CPU_TARGET("avx2")
+inline size_t extract_avx2(const uint8_t* rgb, size_t count, int channel, uint8_t* plane) {
+
+	size_t i = 0;
+
+	for (; i + 32 <= count; i += 32) {
+		__m256i x, y, z;
+		load_pixels_avx2(rgb + i * 3, x, y, z);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(plane + i), shuffle3(x, y, z, split_masks[channel]));
+	}
+
+	return i;
+}
+
+CPU_TARGET("avx2")
+inline size_t deinterleave_avx2(const uint8_t* rgb, size_t count, uint8_t* r, uint8_t* g, uint8_t* b) {
+
+	size_t i = 0;
+
+	for (; i + 32 <= count; i += 32) {
+		__m256i x, y, z;
+		load_pixels_avx2(rgb + i * 3, x, y, z);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(r + i), shuffle3(x, y, z, split_masks[0]));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(g + i), shuffle3(x, y, z, split_masks[1]));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(b + i), shuffle3(x, y, z, split_masks[2]));
+	}
+
+	return i;
+}
+
+CPU_TARGET("avx2")
+inline size_t interleave_avx2(const uint8_t* r, const uint8_t* g, const uint8_t* b, size_t count, uint8_t* rgb) {
+
+	size_t i = 0;
+
+	for (; i + 32 <= count; i += 32) {
+		__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r + i));
+		__m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(g + i));
+		__m256i z = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+
+		// Blocks [0 3], [1 4] and [2 5], stored back in order
+		__m256i blocks03 = shuffle3(x, y, z, merge_masks[0]);
+		__m256i blocks14 = shuffle3(x, y, z, merge_masks[1]);
+		__m256i blocks25 = shuffle3(x, y, z, merge_masks[2]);
+
+		__m256i* output = reinterpret_cast<__m256i*>(rgb + i * 3);
+		_mm256_storeu_si256(output, _mm256_permute2x128_si256(blocks03, blocks14, 0x20));
+		_mm256_storeu_si256(output + 1, _mm256_permute2x128_si256(blocks25, blocks03, 0x30));
+		_mm256_storeu_si256(output + 2, _mm256_permute2x128_si256(blocks14, blocks25, 0x31));
+	}
+
+	return i;
+}
+
+#endif
+
+} // namespace detail
+
+// Copies one channel (0 red, 1 green, 2 blue) of count RGB pixels to plane
+inline void extract_channel(const uint8_t* rgb, size_t count, int channel, uint8_t* plane) {
+
+	size_t i = 0;
+
+#if defined(CPU_X86)
+	switch (detail::cpu_simd_level()) {
+	case detail::simd_level::avx2: i = detail::extract_avx2(rgb, count, channel, plane); break;
+	case detail::simd_level::ssse3: i = detail::extract_ssse3(rgb, count, channel, plane); break;
+	default: break;
+	}
+#endif
+
+	for (; i < count; ++i) {
+		plane[i] = rgb[i * 3 + channel];
+	}
+}
+
+// Splits count RGB pixels into the r, g and b planes
+inline void deinterleave_rgb(const uint8_t* rgb, size_t count, uint8_t* r, uint8_t* g, uint8_t* b) {
+
+	size_t i = 0;
+
+#if defined(CPU_X86)
+	switch (detail::cpu_simd_level()) {
+	case detail::simd_level::avx2: i = detail::deinterleave_avx2(rgb, count, r, g, b); break;
+	case detail::simd_level::ssse3: i = detail::deinterleave_ssse3(rgb, count, r, g, b); break;
+	default: break;
+	}
+#endif
+
+	for (; i < count; ++i) {
+		r[i] = rgb[i * 3];
+		g[i] = rgb[i * 3 + 1];
+		b[i] = rgb[i * 3 + 2];
+	}
+}
+
+// Merges count samples of the r, g and b planes into RGB pixels
+inline void interleave_rgb(const uint8_t* r, const uint8_t* g, const uint8_t* b, size_t count, uint8_t* rgb) {
+
+	size_t i = 0;
+
+#if defined(CPU_X86)
+	switch (detail::cpu_simd_level()) {
+	case detail::simd_level::avx2: i = detail::interleave_avx2(r, g, b, count, rgb); break;
+	case detail::simd_level::ssse3: i = detail::interleave_ssse3(r, g, b, count, rgb); break;
+	default: break;
+	}
+#endif
+
+	for (; i < count; ++i) {
+		rgb[i * 3] = r[i];
+		rgb[i * 3 + 1] = g[i];
+		rgb[i * 3 + 2] = b[i];
+	}
+}
+
+} // namespace planar
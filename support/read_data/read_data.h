@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <istream>
+#include <vector>
+
+// The whole input goes in a single contiguous buffer
+inline std::vector<uint8_t> read_data(std::istream& input) {
+
+	std::vector<uint8_t> data;
+
+	input.seekg(0, std::ios::end);
+	std::streamoff size = input.tellg();
+	input.seekg(0, std::ios::beg);
+
+	if (size > 0) {
+		data.resize(static_cast<size_t>(size));
+		input.read(reinterpret_cast<char*>(data.data()), size);
+		data.resize(static_cast<size_t>(input.gcount()));
+		return data;
+	}
+
+	// Not seekable, read it in blocks
+	input.clear();
+
+	std::vector<char> block(1 << 16);
+
+	while (input.read(block.data(), block.size()) || input.gcount() > 0) {
+		data.insert(data.end(), block.begin(), block.begin() + input.gcount());
+	}
+
+	return data;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <vector>
+#include <algorithm>
+
+// Pool of worker threads started once and kept waiting between the runs, so that a tool can run many small
+// batches (a pass over an image, a block of rows) without creating threads for each of them.
+// run(count, task) calls task(index) for every index in [0, count) on the workers and the calling thread. The
+// indices are handed out one at a time, so tasks of uneven length even out across the threads. One run at a time:
+// calls from several threads wait for each other, and a task must not call run() on its own pool.
+class thread_pool {
+private:
+	std::vector<std::thread> workers_;
+
+	std::mutex run_mutex_;
+	std::mutex mutex_;
+	std::condition_variable work_ready_;
+	std::condition_variable work_done_;
+	bool stopping_ = false;
+
+	// The current run: workers_ take a ticket each up to tickets_, the last one to finish wakes up run()
+	const std::function<void(size_t)>* task_ = nullptr;
+	size_t count_ = 0;
+	std::atomic<size_t> next_index_{ 0 };
+	size_t generation_ = 0;
+	size_t tickets_ = 0;
+	size_t busy_ = 0;
+	std::exception_ptr error_;
+
+	void work() {
+		for (size_t index = next_index_++; index < count_; index = next_index_++) {
+			try {
+				(*task_)(index);
+			}
+			catch (...) {
+				// The other threads stop taking indices, the first exception is thrown by run()
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				if (!error_) {
+					error_ = std::current_exception();
+				}
+
+				next_index_ = count_;
+			}
+		}
+	}
+
+	void worker() {
+		size_t seen_generation = 0;
+		std::unique_lock<std::mutex> lock(mutex_);
+
+		while (true) {
+			work_ready_.wait(lock, [&] { return stopping_ || generation_ != seen_generation; });
+
+			if (stopping_) {
+				return;
+			}
+
+			seen_generation = generation_;
+
+			if (tickets_ == 0) {
+				continue;
+			}
+
+			--tickets_;
+			lock.unlock();
+			work();
+			lock.lock();
+
+			if (--busy_ == 0) {
+				work_done_.notify_one();
+			}
+		}
+	}
+
+public:
+	explicit thread_pool(size_t threads = std::thread::hardware_concurrency()) {
+		for (size_t i = 1; i < std::max<size_t>(threads, 1); ++i) {
+			workers_.emplace_back([this] { worker(); });
+		}
+	}
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	~thread_pool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+
+		work_ready_.notify_all();
+
+		for (auto& worker : workers_) {
+			worker.join();
+		}
+	}
+
+	// The workers and the calling thread
+	size_t threads() const {
+		return workers_.size() + 1;
+	}
+
+	template<typename Task>
+	void run(size_t count, Task task) {
+
+		if (count == 0) {
+			return;
+		}
+
+		std::lock_guard<std::mutex> run_lock(run_mutex_);
+		std::function<void(size_t)> function(std::ref(task));
+
+		size_t helpers = std::min(workers_.size(), count - 1);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			task_ = &function;
+			count_ = count;
+			next_index_ = 0;
+			tickets_ = helpers;
+			busy_ = helpers;
+			error_ = nullptr;
+			++generation_;
+		}
+
+		if (helpers > 0) {
+			work_ready_.notify_all();
+		}
+
+		work();
+
+		// The task lives on this stack, so the workers must be done with it also when it threw
+		std::unique_lock<std::mutex> lock(mutex_);
+		work_done_.wait(lock, [&] { return busy_ == 0; });
+
+		task_ = nullptr;
+
+		if (error_) {
+			std::exception_ptr error = error_;
+			error_ = nullptr;
+			std::rethrow_exception(error);
+		}
+	}
+};